@@ -10,11 +10,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/select.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
 #include "report.h"
 
 /* Some global values */
@@ -31,6 +37,9 @@ static bool block_timing = false;
 static double first_time;
 static double last_time;
 
+/* Hardware counter of cache misses in this thread, or -1 if unavailable */
+static int cache_miss_fd = -1;
+
 /*
  * Implement buffered I/O using variant of RIO package from CS:APP
  * Must create stack of buffers to handle I/O with nested source commands.
@@ -69,13 +78,14 @@ static bool has_infile = false;
 static cmd_function quit_helpers[MAXQUIT];
 static int quit_helper_cnt = 0;
 
+static cmd_hook before_cmd = NULL;
+static cmd_hook after_cmd = NULL;
+
 static void init_in();
 
 static bool push_file(char *fname);
 static void pop_file();
 
-static bool interpret_cmda(int argc, char *argv[]);
-
 /* Add a new command */
 void add_cmd(char *name, cmd_function operation, char *documentation)
 {
@@ -90,10 +100,17 @@ void add_cmd(char *name, cmd_function operation, char *documentation)
     ele->name = name;
     ele->operation = operation;
     ele->documentation = documentation;
+    ele->budget = 0;
     ele->next = next_cmd;
     *last_loc = ele;
 }
 
+void set_cmd_hooks(cmd_hook before, cmd_hook after)
+{
+    before_cmd = before;
+    after_cmd = after;
+}
+
 /* Add a new parameter */
 void add_param(char *name,
                int *valp,
@@ -172,7 +189,7 @@ static void record_error()
 }
 
 /* Execute a command that has already been split into arguments */
-static bool interpret_cmda(int argc, char *argv[])
+bool interpret_cmda(int argc, char *argv[])
 {
     if (argc == 0)
         return true;
@@ -182,7 +199,11 @@ static bool interpret_cmda(int argc, char *argv[])
     while (next_cmd && strcmp(argv[0], next_cmd->name) != 0)
         next_cmd = next_cmd->next;
     if (next_cmd) {
+        if (before_cmd)
+            before_cmd(next_cmd->name, next_cmd->budget);
         ok = next_cmd->operation(argc, argv);
+        if (after_cmd)
+            after_cmd(next_cmd->name, next_cmd->budget);
         if (!ok)
             record_error();
     } else {
@@ -348,6 +369,37 @@ static bool do_option(int argc, char *argv[])
     return true;
 }
 
+static bool do_budget(int argc, char *argv[])
+{
+    if (argc == 1) {
+        report(1, "Budgets:");
+        for (cmd_ptr clist = cmd_list; clist; clist = clist->next) {
+            if (clist->budget)
+                report(1, "\t%s\t%d ms", clist->name, clist->budget);
+        }
+        return true;
+    }
+    if (argc != 3) {
+        report(1, "%s needs 0 or 2 arguments", argv[0]);
+        return false;
+    }
+
+    cmd_ptr clist = cmd_list;
+    while (clist && strcmp(argv[1], clist->name) != 0)
+        clist = clist->next;
+    if (!clist) {
+        report(1, "Unknown command '%s'", argv[1]);
+        return false;
+    }
+    int budget = 0;
+    if (!get_int(argv[2], &budget) || budget < 0) {
+        report(1, "Invalid budget '%s'", argv[2]);
+        return false;
+    }
+    clist->budget = budget;
+    return true;
+}
+
 static bool do_source(int argc, char *argv[])
 {
     if (argc < 2) {
@@ -377,6 +429,29 @@ static bool do_log(int argc, char *argv[])
     return result;
 }
 
+static void init_cache_misses()
+{
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    cache_miss_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (cache_miss_fd >= 0)
+        ioctl(cache_miss_fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+}
+
+/* Read the cache miss counter.  Return false if it is unavailable */
+static bool read_cache_misses(uint64_t *count)
+{
+    return cache_miss_fd >= 0 &&
+           read(cache_miss_fd, count, sizeof(*count)) == sizeof(*count);
+}
+
 static bool do_time(int argc, char *argv[])
 {
     double delta = delta_time(&last_time);
@@ -385,12 +460,18 @@ static bool do_time(int argc, char *argv[])
         double elapsed = last_time - first_time;
         report(1, "Elapsed time = %.3f, Delta time = %.3f", elapsed, delta);
     } else {
+        uint64_t misses_before, misses_after;
+        bool counted = read_cache_misses(&misses_before);
         ok = interpret_cmda(argc - 1, argv + 1);
         if (block_flag) {
             block_timing = true;
         } else {
             delta = delta_time(&last_time);
-            report(1, "Delta time = %.3f", delta);
+            if (counted && read_cache_misses(&misses_after))
+                report(1, "Delta time = %.3f, Cache misses = %" PRIu64, delta,
+                       misses_after - misses_before);
+            else
+                report(1, "Delta time = %.3f", delta);
         }
     }
 
@@ -405,6 +486,8 @@ void init_cmd()
     err_cnt = 0;
     quit_flag = false;
 
+    ADD_COMMAND(budget,
+                " [cmd ms]       | Display or set time budget of command");
     ADD_COMMAND(help, "                | Show documentation");
     ADD_COMMAND(option, " [name val]     | Display or set options");
     ADD_COMMAND(quit, "                | Exit program");
@@ -418,6 +501,7 @@ void init_cmd()
     add_param("echo", &echo, "Do/don't echo commands", NULL);
 
     init_in();
+    init_cache_misses();
     init_time(&last_time);
     first_time = last_time;
 }
@@ -21,9 +21,14 @@ struct CELE {
     char *name;
     cmd_function operation;
     char *documentation;
+    /* Time budget in milliseconds set with the budget command, or 0 */
+    int budget;
     cmd_ptr next;
 };
 
+/* Optionally supply functions invoked before and after each command */
+typedef void (*cmd_hook)(const char *name, int budget);
+
 /* Optionally supply function that gets invoked when parameter changes */
 typedef void (*setter_function)(int oldval);
 
@@ -45,12 +50,18 @@ void init_cmd();
 void add_cmd(char *name, cmd_function operation, char *documentation);
 #define ADD_COMMAND(cmd, msg) add_cmd(#cmd, do_##cmd, msg)
 
+/* Set functions invoked before and after each command, or NULL for none */
+void set_cmd_hooks(cmd_hook before, cmd_hook after);
+
 /* Add a new parameter */
 void add_param(char *name,
                int *valp,
                char *doccumentation,
                setter_function setter);
 
+/* Execute a command that has already been split into arguments */
+bool interpret_cmda(int argc, char *argv[]);
+
 /* Extract integer from text and store at loc */
 bool get_int(char *vname, int *loc);
 
@@ -33,6 +33,7 @@ enum {
     test_insert_tail,
     test_remove_head,
     test_remove_tail,
+    test_delete_mid,
 };
 
 /* Implement the necessary queue interface to simulation */
@@ -69,7 +70,8 @@ void measure(int64_t *before_ticks,
              int mode)
 {
     assert(mode == test_insert_head || mode == test_insert_tail ||
-           mode == test_remove_head || mode == test_remove_tail);
+           mode == test_remove_head || mode == test_remove_tail ||
+           mode == test_delete_mid);
 
     switch (mode) {
     case test_insert_head:
@@ -126,6 +128,19 @@ void measure(int64_t *before_ticks,
             dut_free();
         }
         break;
+    case test_delete_mid:
+        /* Keep both classes non-empty so only the queue length differs */
+        for (size_t i = drop_size; i < n_measure - drop_size; i++) {
+            dut_new();
+            dut_insert_head(
+                get_random_string(),
+                *(uint16_t *) (input_data + i * chunk_size) % 10000 + 1);
+            before_ticks[i] = cpucycles();
+            q_delete_mid(l);
+            after_ticks[i] = cpucycles();
+            dut_free();
+        }
+        break;
     default:
         for (size_t i = drop_size; i < n_measure - drop_size; i++) {
             dut_new();
@@ -1,10 +1,21 @@
 /* Test support code */
 
+/* For pthread_getattr_np and dladdr */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
 #include <setjmp.h>
 #include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "report.h"
@@ -13,6 +24,11 @@
 #define INTERNAL 1
 #include "harness.h"
 
+/* Older glibc only names the thread of SIGEV_THREAD_ID by its internal field */
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
 /** Special values **/
 
 /* Value at start of every allocated block */
@@ -24,54 +40,593 @@
 /* Value at end of every block */
 #define MAGICFOOTER 0xbeefdead
 
+/* Value at start of every block placed in front of a guard page */
+#define MAGICGUARD 0xfeedbeef
+
 /* Byte to fill newly malloced space with */
 #define FILLCHAR 0x55
 
+/* Byte to fill the padding behind the payload of a guarded block with */
+#define GUARDCHAR 0xaa
+
+/* Deepest backtrace recorded per allocation */
+#define MAX_BACKTRACE 16
+
 /* Data structures used by our code */
 
+/*
+ * Backtrace of an allocation, as the return addresses of the frames above the
+ * harness.  Each is stored once in a hash table, however many blocks share
+ * it, and never freed.
+ */
+typedef struct backtrace {
+    uint64_t hash;
+    int depth;
+    void *frames[MAX_BACKTRACE];
+    struct backtrace *next;
+} backtrace_t;
+
 /*
  * Represent allocated blocks as doubly-linked list, with
  * next and prev pointers at beginning
  */
 typedef struct BELE {
     struct BELE *next, *prev;
+    /* List the block is on */
+    struct block_list *list;
+    /* Call site that allocated the block, and when */
+    alloc_site_t *site;
+    double birth;
+    /* Backtrace of the allocation, or NULL if not recorded */
+    backtrace_t *trace;
+    /* Number of the allocator operation that allocated the block */
+    size_t birth_op;
     size_t payload_size;
     size_t magic_header; /* Marker to see if block seems legitimate */
-    unsigned char payload[0];
+    /* Aligned like malloc aligns, whatever members come before */
+    _Alignas(max_align_t) unsigned char payload[0];
     /* Also place magic number at tail of every block */
 } block_ele_t;
 
-static block_ele_t *allocated = NULL;
-static size_t allocated_count = 0;
+_Static_assert(offsetof(block_ele_t, payload) % _Alignof(max_align_t) == 0 &&
+                   sizeof(block_ele_t) == offsetof(block_ele_t, payload),
+               "payload must start at the end of an aligned header");
+
+/*
+ * Every thread puts the blocks it allocates on a list of its own, so that
+ * threads rarely contend for a list.  A block freed by another thread is
+ * unlinked under the lock of the list it is on.  Lists outlive their threads,
+ * to keep the blocks those leave behind, and are handed on to new threads.
+ * Until a second list is made, its owner is the only thread using the
+ * allocator and skips the lock, merely marking the list busy meanwhile.
+ */
+typedef struct block_list {
+    block_ele_t *allocated;
+    size_t allocated_count;
+    pthread_mutex_t lock;
+    bool busy;
+    bool in_use;
+    struct block_list *next;
+} block_list_t;
+
+static block_list_t *block_lists = NULL;
+/* Whether there ever were two lists, after which every list is locked */
+static bool lists_shared = false;
+static pthread_mutex_t block_lists_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t block_list_key;
+static pthread_once_t block_list_once = PTHREAD_ONCE_INIT;
+static __thread block_list_t *thread_blocks = NULL;
+
+/*
+ * Quarantine of freed blocks.  They are held back from libc in FIFO order
+ * until they take more bytes than the budget allows, and checked to be still
+ * poisoned when finally released, so that writes after free get noticed.
+ */
+static block_ele_t *quarantine_head = NULL;
+static block_ele_t *quarantine_tail = NULL;
+static size_t quarantine_bytes = 0;
+static size_t quarantine_budget = 0;
+static pthread_mutex_t quarantine_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Blocks and bytes allocated by all threads, and the most there ever were */
+static size_t live_blocks = 0;
+static size_t live_bytes = 0;
+static size_t peak_blocks = 0;
+static size_t peak_bytes = 0;
+
+/* Backtraces recorded so far, hashed on their frames */
+#define BACKTRACE_BUCKETS 1024
+static backtrace_t *backtraces[BACKTRACE_BUCKETS];
+static pthread_mutex_t backtraces_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Number of frames to record per allocation, or 0 for none */
+static int backtrace_depth = 0;
+/* Stack of the calling thread, which frame pointers must point into */
+static __thread uintptr_t stack_low = 0;
+static __thread uintptr_t stack_high = 0;
+
+/* Whether blocks are timed for the lifetimes of their call sites */
+static bool profiling_on = false;
+
+/*
+ * Histograms of the sizes and lifetimes of blocks, and the count of calls of
+ * malloc, realloc and free that lifetimes in operations are measured in
+ */
+static bool histograms_on = false;
+static alloc_histograms_t histograms;
+static size_t operation_number = 0;
+
+/* Call sites used so far, and the one standing for unknown callers */
+static alloc_site_t *sites = NULL;
+static pthread_mutex_t sites_lock = PTHREAD_MUTEX_INITIALIZER;
+static alloc_site_t unknown_site = {.func = "test_malloc"};
+
+/*
+ * Set of allocated blocks, so that cautious mode can check a block in O(1)
+ * time.  The address space is split into regions of 2^REGION_SHIFT bytes,
+ * each with a bitmap holding one bit per possible block address in it, and
+ * the regions in use are found through a hash table.  Blocks allocated one
+ * after another mostly share a region and even a bitmap word, which keeps
+ * updates cache friendly.  Bits are flipped atomically, and only the hash
+ * table takes a lock, which each thread avoids by remembering its last region.
+ * Regions are never freed.
+ */
+#define REGION_SHIFT 19
+/* Blocks are at least 8-byte aligned */
+#define GRAIN_SHIFT 3
+#define REGION_WORDS (((size_t) 1 << (REGION_SHIFT - GRAIN_SHIFT)) / 64)
+
+typedef struct {
+    uintptr_t number;
+    uint64_t bits[REGION_WORDS];
+} region_t;
+
+static region_t **regions = NULL;
+static size_t regions_size = 0;
+static size_t regions_count = 0;
+static pthread_mutex_t regions_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Region used last, which the next block is likely to be in as well */
+static __thread region_t *last_region = NULL;
 
 /* Percent probability of malloc failure */
 int fail_probability = 0;
 
+/*
+ * Allocations are numbered, and whether one fails at random is derived from
+ * its number and the seed alone, so that a seed replays the same failures.
+ */
+static uint64_t fail_seed = 0;
+static size_t allocation_number = 0;
+/* Number of the one allocation to fail, or 0 */
+static size_t fail_nth = 0;
+static bool fail_nth_hit = false;
+/* Function name or file:line of the call site to fail, or empty */
+#define SITE_SPEC_LEN 128
+static char fail_site[SITE_SPEC_LEN] = "";
+
 static bool cautious_mode = true;
-static bool noallocate_mode = false;
+static bool guard_mode = false;
+static size_t fill_limit = 0;
+/* Restricts the calling thread only, as others may free blocks meanwhile */
+static __thread bool noallocate_mode = false;
 static bool error_occurred = false;
-static char *error_message = "";
 
-static int time_limit = 1;
+/* Time limit of risky operations in seconds, and the factor it is scaled by */
+static double time_limit = 1.0;
+static double time_scale = 1.0;
+
+/*
+ * Seconds the calibration workload takes on the machine the time limits of
+ * the traces were chosen on
+ */
+#define CALIBRATION_REFERENCE 0.030
+#define CALIBRATION_BLOCKS 1000000
 
 /*
- * Data for managing exceptions
+ * Data for managing exceptions, kept per thread
  */
-static jmp_buf env;
-static volatile sig_atomic_t jmp_ready = false;
-static bool time_limited = false;
+static __thread char *error_message = "";
+static __thread sigjmp_buf env;
+static __thread volatile sig_atomic_t jmp_ready = false;
+static __thread bool time_limited = false;
+/* Timer raising SIGALRM in the thread once its time limit is up */
+static __thread timer_t limit_timer;
+static __thread bool limit_timer_made = false;
+/* When the limited operation started, and its limit */
+static __thread double limit_start;
+static __thread double limit_seconds;
+/* Largest share of its limit a limited operation used since last asked */
+static __thread double limit_used = 0;
 
 /*
  * Internal functions
  */
 
+/* Does call site match the spec of set_fail_site()? */
+static bool site_matches(const alloc_site_t *site, const char *spec)
+{
+    const char *colon = strrchr(spec, ':');
+    if (!colon)
+        return site->func && !strcmp(site->func, spec);
+
+    size_t len = colon - spec;
+    return site->file && strlen(site->file) == len &&
+           !strncmp(site->file, spec, len) && site->line == atoi(colon + 1);
+}
+
 /* Should this allocation fail? */
-static bool fail_allocation()
+static bool fail_allocation(const alloc_site_t *site)
 {
-    double weight = (double) random() / RAND_MAX;
+    size_t n = __atomic_add_fetch(&allocation_number, 1, __ATOMIC_RELAXED);
+    if (n == fail_nth) {
+        fail_nth_hit = true;
+        return true;
+    }
+    if (fail_site[0] && site_matches(site, fail_site))
+        return true;
+    if (!fail_probability)
+        return false;
+
+    /* splitmix64 of the allocation number */
+    uint64_t z = fail_seed + n * 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    double weight = (double) (z >> 11) / (1ULL << 53);
     return (weight < 0.01 * fail_probability);
 }
 
+/* Record an error, whichever thread it occurred on */
+static void set_error()
+{
+    __atomic_store_n(&error_occurred, true, __ATOMIC_RELAXED);
+}
+
+/* Monotonic time in seconds */
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Slot of region number n in the table, or the empty slot where it goes */
+static size_t region_slot(uintptr_t n)
+{
+    size_t i = (n * 0x9E3779B97F4A7C15ULL) & (regions_size - 1);
+    while (regions[i] && regions[i]->number != n)
+        i = (i + 1) & (regions_size - 1);
+    return i;
+}
+
+/* Move the regions into a table twice as large, or a first one */
+static void grow_regions()
+{
+    region_t **old = regions;
+    size_t old_size = regions_size;
+    regions_size = old ? old_size * 2 : 64;
+    regions = calloc(regions_size, sizeof(region_t *));
+    if (!regions) {
+        report_event(MSG_FATAL, "Couldn't allocate any more memory");
+        set_error();
+    }
+    for (size_t i = 0; i < old_size; i++) {
+        if (old[i])
+            regions[region_slot(old[i]->number)] = old[i];
+    }
+    free(old);
+}
+
+/* Region holding address a, created on demand if create is set */
+static region_t *find_region(uintptr_t a, bool create)
+{
+    uintptr_t n = a >> REGION_SHIFT;
+    if (last_region && last_region->number == n)
+        return last_region;
+
+    pthread_mutex_lock(&regions_lock);
+    if (!regions) {
+        if (!create) {
+            pthread_mutex_unlock(&regions_lock);
+            return NULL;
+        }
+        grow_regions();
+    }
+
+    size_t i = region_slot(n);
+    if (!regions[i]) {
+        if (!create) {
+            pthread_mutex_unlock(&regions_lock);
+            return NULL;
+        }
+        /* Keep the table at most half full */
+        if (regions_count * 2 >= regions_size) {
+            grow_regions();
+            i = region_slot(n);
+        }
+        regions[i] = calloc(1, sizeof(region_t));
+        if (!regions[i]) {
+            report_event(MSG_FATAL, "Couldn't allocate any more memory");
+            set_error();
+        }
+        regions[i]->number = n;
+        regions_count++;
+    }
+
+    last_region = regions[i];
+    pthread_mutex_unlock(&regions_lock);
+    return last_region;
+}
+
+/* Bit of block b within its region */
+static inline size_t block_bit(const block_ele_t *b)
+{
+    return ((uintptr_t) b >> GRAIN_SHIFT) &
+           (((size_t) 1 << (REGION_SHIFT - GRAIN_SHIFT)) - 1);
+}
+
+static bool block_set_contains(const block_ele_t *b)
+{
+    uintptr_t a = (uintptr_t) b;
+    if (a & (((uintptr_t) 1 << GRAIN_SHIFT) - 1))
+        return false;
+
+    region_t *r = find_region(a, false);
+    size_t bit = block_bit(b);
+    return r && (__atomic_load_n(&r->bits[bit / 64], __ATOMIC_RELAXED) >>
+                     (bit % 64) &
+                 1);
+}
+
+static void block_set_add(const block_ele_t *b)
+{
+    region_t *r = find_region((uintptr_t) b, true);
+    size_t bit = block_bit(b);
+    __atomic_fetch_or(&r->bits[bit / 64], (uint64_t) 1 << (bit % 64),
+                      __ATOMIC_RELAXED);
+}
+
+static void block_set_remove(const block_ele_t *b)
+{
+    region_t *r = find_region((uintptr_t) b, false);
+    size_t bit = block_bit(b);
+    if (r)
+        __atomic_fetch_and(&r->bits[bit / 64], ~((uint64_t) 1 << (bit % 64)),
+                           __ATOMIC_RELAXED);
+}
+
+/* Hand the list of an exiting thread on to threads started later */
+static void release_block_list(void *list)
+{
+    pthread_mutex_lock(&block_lists_lock);
+    ((block_list_t *) list)->in_use = false;
+    pthread_mutex_unlock(&block_lists_lock);
+}
+
+static void make_block_list_key()
+{
+    pthread_key_create(&block_list_key, release_block_list);
+}
+
+/*
+ * Make every thread lock the lists from now on, and wait for an owner still
+ * using its list without the lock.  Call with block_lists_lock held.
+ */
+static void share_lists()
+{
+    __atomic_store_n(&lists_shared, true, __ATOMIC_SEQ_CST);
+    for (block_list_t *list = block_lists; list; list = list->next) {
+        while (__atomic_load_n(&list->busy, __ATOMIC_SEQ_CST))
+            sched_yield();
+    }
+}
+
+/* List of blocks allocated by the calling thread */
+static block_list_t *my_block_list()
+{
+    if (thread_blocks)
+        return thread_blocks;
+
+    pthread_once(&block_list_once, make_block_list_key);
+    pthread_mutex_lock(&block_lists_lock);
+    block_list_t *list = block_lists;
+    while (list && list->in_use)
+        list = list->next;
+    if (!list) {
+        list = calloc(1, sizeof(block_list_t));
+        if (!list) {
+            report_event(MSG_FATAL, "Couldn't allocate any more memory");
+            set_error();
+        }
+        pthread_mutex_init(&list->lock, NULL);
+        list->next = block_lists;
+        block_lists = list;
+    }
+    list->in_use = true;
+    if (block_lists->next && !lists_shared)
+        share_lists();
+    pthread_mutex_unlock(&block_lists_lock);
+
+    pthread_setspecific(block_list_key, list);
+    thread_blocks = list;
+    return list;
+}
+
+/*
+ * Lock list, unless the calling thread owns it and no other list was made
+ * yet.  Return whether it was locked, which unlock_list() is to be told.
+ */
+static bool lock_list(block_list_t *list)
+{
+    if (list == thread_blocks) {
+        /* Pairs with share_lists(), which sets the flag and checks busy */
+        __atomic_store_n(&list->busy, true, __ATOMIC_SEQ_CST);
+        if (!__atomic_load_n(&lists_shared, __ATOMIC_SEQ_CST))
+            return false;
+        __atomic_store_n(&list->busy, false, __ATOMIC_RELEASE);
+    } else if (!thread_blocks) {
+        /* Making a list of our own gets the owner of this one to lock it */
+        my_block_list();
+    }
+    pthread_mutex_lock(&list->lock);
+    return true;
+}
+
+static void unlock_list(block_list_t *list, bool locked)
+{
+    if (locked)
+        pthread_mutex_unlock(&list->lock);
+    else
+        __atomic_store_n(&list->busy, false, __ATOMIC_RELEASE);
+}
+
+/*
+ * Take block_lists_lock to walk the lists.  The calling thread gets a list
+ * first, which lock_list() cannot make it with the lock held.
+ */
+static void lock_block_lists()
+{
+    my_block_list();
+    pthread_mutex_lock(&block_lists_lock);
+}
+
+/* Add the first block of a call site to the list of sites */
+static void register_site(alloc_site_t *site)
+{
+    pthread_mutex_lock(&sites_lock);
+    if (!site->registered) {
+        site->next = sites;
+        sites = site;
+        __atomic_store_n(&site->registered, true, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&sites_lock);
+}
+
+/* Raise peak to live, unless another thread raised it further */
+static void raise_peak(size_t *peak, size_t live)
+{
+    size_t old = __atomic_load_n(peak, __ATOMIC_RELAXED);
+    while (live > old &&
+           !__atomic_compare_exchange_n(peak, &old, live, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/* Add bytes requested from call site to its total and live bytes */
+static void add_bytes(alloc_site_t *site, size_t size)
+{
+    __atomic_add_fetch(&site->bytes, size, __ATOMIC_RELAXED);
+    raise_peak(&site->peak_bytes, __atomic_add_fetch(&site->live_bytes, size,
+                                                     __ATOMIC_RELAXED));
+    raise_peak(&peak_bytes,
+               __atomic_add_fetch(&live_bytes, size, __ATOMIC_RELAXED));
+}
+
+/* Take bytes of a freed or shrunk block off the live bytes of its site */
+static void sub_bytes(alloc_site_t *site, size_t size)
+{
+    __atomic_sub_fetch(&site->live_bytes, size, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&live_bytes, size, __ATOMIC_RELAXED);
+}
+
+/* Bucket of value in a histogram, holding values of its bit length */
+static int histogram_bucket(uint64_t value)
+{
+    int bucket = value ? 64 - __builtin_clzll(value) : 0;
+    return bucket < HISTOGRAM_BUCKETS ? bucket : HISTOGRAM_BUCKETS - 1;
+}
+
+/* Count an allocator operation, and return its number if histograms are on */
+static size_t count_operation()
+{
+    if (!histograms_on)
+        return 0;
+    return __atomic_add_fetch(&operation_number, 1, __ATOMIC_RELAXED);
+}
+
+/* Add lifetime of a freed block to its call site */
+static void add_lifetime(alloc_site_t *site, double lifetime)
+{
+    double old, new;
+    __atomic_load(&site->lifetime, &old, __ATOMIC_RELAXED);
+    do {
+        new = old + lifetime;
+    } while (!__atomic_compare_exchange(&site->lifetime, &old, &new, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/*
+ * Store up to max return addresses in frames, following the frame pointers
+ * and skipping the first skip of them, and return how many there were.  The
+ * walk stops at the first frame pointer leaving the stack of the thread or
+ * not leading towards its base, as code built without frame pointers leaves
+ * anything there.
+ */
+static __attribute__((noinline)) int unwind(void **frames, int max, int skip)
+{
+    if (!stack_high) {
+        pthread_attr_t attr;
+        void *addr;
+        size_t size;
+        if (pthread_getattr_np(pthread_self(), &attr))
+            return 0;
+        pthread_attr_getstack(&attr, &addr, &size);
+        pthread_attr_destroy(&attr);
+        stack_low = (uintptr_t) addr;
+        stack_high = stack_low + size;
+    }
+
+    uintptr_t *fp = __builtin_frame_address(0);
+    int n = -skip;
+    while (n < max && (uintptr_t) fp >= stack_low &&
+           (uintptr_t) (fp + 2) <= stack_high &&
+           !((uintptr_t) fp % sizeof(uintptr_t))) {
+        if (!fp[1])
+            break;
+        if (n >= 0)
+            frames[n] = (void *) fp[1];
+        n++;
+        uintptr_t *next = (uintptr_t *) fp[0];
+        if (next <= fp)
+            break;
+        fp = next;
+    }
+    return n < 0 ? 0 : n;
+}
+
+/* Record the backtrace of the calling allocation, or return NULL */
+static __attribute__((noinline)) backtrace_t *record_backtrace()
+{
+    void *frames[MAX_BACKTRACE];
+    /* Skip the returns into this function and into test_malloc_at */
+    int depth = unwind(frames, backtrace_depth, 2);
+    if (!depth)
+        return NULL;
+
+    /* FNV-1a over the return addresses */
+    uint64_t hash = 0xcbf29ce484222325;
+    for (int i = 0; i < depth; i++)
+        hash = (hash ^ (uintptr_t) frames[i]) * 0x100000001b3;
+
+    pthread_mutex_lock(&backtraces_lock);
+    backtrace_t **bucket = &backtraces[hash % BACKTRACE_BUCKETS];
+    backtrace_t *t = *bucket;
+    while (t && (t->hash != hash || t->depth != depth ||
+                 memcmp(t->frames, frames, depth * sizeof(void *))))
+        t = t->next;
+    if (!t) {
+        t = malloc(sizeof(backtrace_t));
+        if (t) {
+            t->hash = hash;
+            t->depth = depth;
+            memcpy(t->frames, frames, depth * sizeof(void *));
+            t->next = *bucket;
+            *bucket = t;
+        }
+    }
+    pthread_mutex_unlock(&backtraces_lock);
+    return t;
+}
+
 /*
  * Find header of block, given its payload.
  * Signal error if doesn't seem like legitimate block
@@ -80,32 +635,26 @@ static block_ele_t *find_header(void *p)
 {
     if (!p) {
         report_event(MSG_ERROR, "Attempting to free null block");
-        error_occurred = true;
+        set_error();
     }
 
     block_ele_t *b = (block_ele_t *) ((size_t) p - sizeof(block_ele_t));
     if (cautious_mode) {
         /* Make sure this is really an allocated block */
-        block_ele_t *ab = allocated;
-        bool found = false;
-        while (ab && !found) {
-            found = ab == b;
-            ab = ab->next;
-        }
-        if (!found) {
+        if (!block_set_contains(b)) {
             report_event(MSG_ERROR,
                          "Attempted to free unallocated block.  Address = %p",
                          p);
-            error_occurred = true;
+            set_error();
         }
     }
 
-    if (b->magic_header != MAGICHEADER) {
+    if (b->magic_header != MAGICHEADER && b->magic_header != MAGICGUARD) {
         report_event(
             MSG_ERROR,
             "Attempted to free unallocated or corrupted block.  Address = %p",
             p);
-        error_occurred = true;
+        set_error();
     }
 
     return b;
@@ -119,44 +668,197 @@ static size_t *find_footer(block_ele_t *b)
     return p;
 }
 
+/* Fill payload of given size, unless it is too large to be worth it */
+static void fill_payload(void *p, size_t size)
+{
+    if (!fill_limit || size < fill_limit)
+        memset(p, FILLCHAR, size);
+}
+
+/* Payload size of a guarded block, rounded up to keep the payload aligned */
+static size_t guard_payload_size(size_t size)
+{
+    return (size + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1);
+}
+
+/* Bytes mapped for a guarded block, guard page included */
+static size_t guard_map_size(size_t size)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t room = sizeof(block_ele_t) + guard_payload_size(size);
+    return ((room + page - 1) & ~(page - 1)) + page;
+}
+
+/*
+ * Map a block whose payload ends where an inaccessible page starts, so that
+ * running off its end faults right away.  Its padding is checked when it is
+ * freed instead of a footer.
+ */
+static block_ele_t *guard_alloc(size_t size)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t map_size = guard_map_size(size);
+    unsigned char *map = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+        return NULL;
+    unsigned char *guard = map + map_size - page;
+    if (mprotect(guard, page, PROT_NONE)) {
+        munmap(map, map_size);
+        return NULL;
+    }
+
+    block_ele_t *b = (block_ele_t *) (guard - guard_payload_size(size) -
+                                      sizeof(block_ele_t));
+    b->magic_header = MAGICGUARD;
+    b->payload_size = size;
+    memset(b->payload + size, GUARDCHAR, guard_payload_size(size) - size);
+    return b;
+}
+
+/* Whether padding of a guarded block is still intact */
+static bool guard_intact(block_ele_t *b)
+{
+    for (size_t i = b->payload_size; i < guard_payload_size(b->payload_size);
+         i++) {
+        if (b->payload[i] != GUARDCHAR)
+            return false;
+    }
+    return true;
+}
+
+/* Unmap a guarded block, which makes any later access to it fault too */
+static void guard_free(block_ele_t *b)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    munmap((void *) ((uintptr_t) b & ~(page - 1)),
+           guard_map_size(b->payload_size));
+}
+
+/* Whether all n bytes at p are FILLCHAR */
+static bool poisoned(const unsigned char *p, size_t n)
+{
+    return !n || (p[0] == FILLCHAR && !memcmp(p, p + 1, n - 1));
+}
+
+/* Bytes block b takes in the quarantine */
+static size_t quarantine_size(const block_ele_t *b)
+{
+    return sizeof(block_ele_t) + b->payload_size + sizeof(size_t);
+}
+
+/* Free oldest block in quarantine, checking it was left alone.  Call locked */
+static void quarantine_release()
+{
+    block_ele_t *b = quarantine_head;
+    quarantine_head = b->next;
+    if (!quarantine_head)
+        quarantine_tail = NULL;
+    quarantine_bytes -= quarantine_size(b);
+
+    if (b->magic_header != MAGICFREE || *find_footer(b) != MAGICFREE ||
+        !poisoned(b->payload, b->payload_size)) {
+        const alloc_site_t *site = b->site;
+        report_event(MSG_ERROR,
+                     "Block with address %p allocated by %s:%d was written "
+                     "after it was freed",
+                     (void *) b->payload, site->file ? site->file : site->func,
+                     site->line);
+        set_error();
+    }
+    free(b);
+}
+
+/*
+ * Put freed block b into quarantine instead of freeing it, unless it does not
+ * fit or was not poisoned.  Return whether it was put there
+ */
+static bool quarantine(block_ele_t *b)
+{
+    if (!quarantine_budget || quarantine_size(b) > quarantine_budget ||
+        (fill_limit && b->payload_size >= fill_limit))
+        return false;
+
+    pthread_mutex_lock(&quarantine_lock);
+    b->next = NULL;
+    if (quarantine_tail)
+        quarantine_tail->next = b;
+    else
+        quarantine_head = b;
+    quarantine_tail = b;
+    quarantine_bytes += quarantine_size(b);
+    while (quarantine_bytes > quarantine_budget)
+        quarantine_release();
+    pthread_mutex_unlock(&quarantine_lock);
+    return true;
+}
+
 /*
  * Implementation of application functions
  */
 void *test_malloc(size_t size)
+{
+    return test_malloc_at(size, &unknown_site);
+}
+
+void *test_malloc_at(size_t size, alloc_site_t *site)
 {
     if (noallocate_mode) {
         report_event(MSG_FATAL, "Calls to malloc disallowed");
         return NULL;
     }
 
-    if (fail_allocation()) {
+    if (fail_allocation(site)) {
         report_event(MSG_WARN, "Malloc returning NULL");
         return NULL;
     }
 
     block_ele_t *new_block =
-        malloc(size + sizeof(block_ele_t) + sizeof(size_t));
+        guard_mode ? guard_alloc(size)
+                   : malloc(size + sizeof(block_ele_t) + sizeof(size_t));
     if (!new_block) {
         report_event(MSG_FATAL, "Couldn't allocate any more memory");
-        error_occurred = true;
+        set_error();
     }
 
-    // cppcheck-suppress nullPointerRedundantCheck
-    new_block->magic_header = MAGICHEADER;
-    // cppcheck-suppress nullPointerRedundantCheck
-    new_block->payload_size = size;
-    *find_footer(new_block) = MAGICFOOTER;
+    if (!guard_mode) {
+        // cppcheck-suppress nullPointerRedundantCheck
+        new_block->magic_header = MAGICHEADER;
+        // cppcheck-suppress nullPointerRedundantCheck
+        new_block->payload_size = size;
+        *find_footer(new_block) = MAGICFOOTER;
+    }
     void *p = (void *) &new_block->payload;
-    memset(p, FILLCHAR, size);
+    fill_payload(p, size);
+    block_list_t *list = my_block_list();
     // cppcheck-suppress nullPointerRedundantCheck
-    new_block->next = allocated;
+    new_block->list = list;
     // cppcheck-suppress nullPointerRedundantCheck
     new_block->prev = NULL;
 
-    if (allocated)
-        allocated->prev = new_block;
-    allocated = new_block;
-    allocated_count++;
+    bool locked = lock_list(list);
+    new_block->next = list->allocated;
+    if (list->allocated)
+        list->allocated->prev = new_block;
+    list->allocated = new_block;
+    list->allocated_count++;
+    unlock_list(list, locked);
+    block_set_add(new_block);
+
+    if (!__atomic_load_n(&site->registered, __ATOMIC_ACQUIRE))
+        register_site(site);
+    new_block->site = site;
+    /* Zero marks a block that was not timed */
+    new_block->birth = profiling_on || histograms_on ? now() : 0;
+    new_block->trace = backtrace_depth ? record_backtrace() : NULL;
+    new_block->birth_op = count_operation();
+    if (histograms_on)
+        __atomic_add_fetch(&histograms.sizes[histogram_bucket(size)], 1,
+                           __ATOMIC_RELAXED);
+    __atomic_add_fetch(&site->allocs, 1, __ATOMIC_RELAXED);
+    add_bytes(site, size);
+    raise_peak(&peak_blocks,
+               __atomic_add_fetch(&live_blocks, 1, __ATOMIC_RELAXED));
 
     return p;
 }
@@ -184,37 +886,180 @@ void test_free(void *p)
         return;
 
     block_ele_t *b = find_header(p);
-    size_t footer = *find_footer(b);
-    if (footer != MAGICFOOTER) {
+    bool guarded = b->magic_header == MAGICGUARD;
+    if (guarded ? !guard_intact(b) : *find_footer(b) != MAGICFOOTER) {
         report_event(MSG_ERROR,
                      "Corruption detected in block with address %p when "
                      "attempting to free it",
                      p);
-        error_occurred = true;
+        set_error();
     }
     b->magic_header = MAGICFREE;
-    *find_footer(b) = MAGICFREE;
-    memset(p, FILLCHAR, b->payload_size);
+    if (!guarded) {
+        *find_footer(b) = MAGICFREE;
+        fill_payload(p, b->payload_size);
+    }
 
     /* Unlink from list */
+    block_list_t *list = b->list;
+    bool locked = lock_list(list);
     block_ele_t *bn = b->next;
     block_ele_t *bp = b->prev;
     if (bp)
         bp->next = bn;
     else
-        allocated = bn;
+        list->allocated = bn;
     if (bn)
         bn->prev = bp;
+    list->allocated_count--;
+    unlock_list(list, locked);
+    block_set_remove(b);
 
-    free(b);
-    allocated_count--;
+    alloc_site_t *site = b->site;
+    __atomic_add_fetch(&site->frees, 1, __ATOMIC_RELAXED);
+    sub_bytes(site, b->payload_size);
+    __atomic_sub_fetch(&live_blocks, 1, __ATOMIC_RELAXED);
+    bool timed = b->birth && (profiling_on || histograms_on);
+    double lifetime = timed ? now() - b->birth : 0;
+    if (timed && profiling_on) {
+        add_lifetime(site, lifetime);
+        __atomic_add_fetch(&site->timed_frees, 1, __ATOMIC_RELAXED);
+    }
+    size_t op = count_operation();
+    /* Blocks allocated before the histograms were on have no birth_op */
+    if (op && b->birth_op && timed) {
+        int ns = histogram_bucket((uint64_t) (lifetime * 1e9));
+        int ops = histogram_bucket(op - b->birth_op);
+        __atomic_add_fetch(&histograms.lifetime_ns[ns], 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&histograms.lifetime_ops[ops], 1, __ATOMIC_RELAXED);
+    }
+
+    if (guarded)
+        guard_free(b);
+    else if (!quarantine(b))
+        free(b);
+}
+
+/*
+ * Resize block b to hold size bytes, moving it unless it can be resized where
+ * it is.  Return the block, or NULL if there was no memory, in which case b
+ * is left as it was.
+ */
+static block_ele_t *resize_block(block_ele_t *b, size_t size)
+{
+    if (b->magic_header != MAGICGUARD)
+        return realloc(b, size + sizeof(block_ele_t) + sizeof(size_t));
+
+    /* A guarded block has to end at its guard page, so it always moves */
+    block_ele_t *nb = guard_alloc(size);
+    if (!nb)
+        return NULL;
+    nb->next = b->next;
+    nb->prev = b->prev;
+    nb->list = b->list;
+    nb->site = b->site;
+    nb->birth = b->birth;
+    nb->trace = b->trace;
+    nb->birth_op = b->birth_op;
+    memcpy(nb->payload, b->payload,
+           size < b->payload_size ? size : b->payload_size);
+    guard_free(b);
+    return nb;
+}
+
+// cppcheck-suppress unusedFunction
+void *test_realloc(void *p, size_t size)
+{
+    return test_realloc_at(p, size, &unknown_site);
+}
+
+void *test_realloc_at(void *p, size_t size, alloc_site_t *site)
+{
+    if (!p)
+        return test_malloc_at(size, site);
+    if (!size) {
+        test_free(p);
+        return NULL;
+    }
+    if (noallocate_mode) {
+        report_event(MSG_FATAL, "Calls to realloc disallowed");
+        return NULL;
+    }
+
+    block_ele_t *b = find_header(p);
+    bool guarded = b->magic_header == MAGICGUARD;
+    if (guarded ? !guard_intact(b) : *find_footer(b) != MAGICFOOTER) {
+        report_event(MSG_ERROR,
+                     "Corruption detected in block with address %p when "
+                     "attempting to realloc it",
+                     p);
+        set_error();
+    }
+
+    size_t old_size = b->payload_size;
+    if (size > old_size && fail_allocation(site)) {
+        report_event(MSG_WARN, "Realloc returning NULL");
+        return NULL;
+    }
+
+    /* The neighbors of the block must not change it while it may move */
+    block_list_t *list = b->list;
+    bool locked = lock_list(list);
+    block_set_remove(b);
+    block_ele_t *nb = resize_block(b, size);
+    if (!nb) {
+        block_set_add(b);
+        unlock_list(list, locked);
+        report_event(MSG_FATAL, "Couldn't allocate any more memory");
+        set_error();
+        return NULL;
+    }
+    if (nb != b) {
+        if (nb->prev)
+            nb->prev->next = nb;
+        else
+            list->allocated = nb;
+        if (nb->next)
+            nb->next->prev = nb;
+    }
+    block_set_add(nb);
+    unlock_list(list, locked);
+
+    nb->payload_size = size;
+    if (!guarded)
+        *find_footer(nb) = MAGICFOOTER;
+    if (size > old_size)
+        fill_payload(nb->payload + old_size, size - old_size);
+
+    if (!__atomic_load_n(&site->registered, __ATOMIC_ACQUIRE))
+        register_site(site);
+    __atomic_add_fetch(&site->reallocs, 1, __ATOMIC_RELAXED);
+    count_operation();
+    if (nb != b) {
+        __atomic_add_fetch(&site->moves, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&site->copied_bytes,
+                           size < old_size ? size : old_size,
+                           __ATOMIC_RELAXED);
+    }
+    /* The bytes still belong to the site that allocated the block */
+    if (size > old_size)
+        add_bytes(nb->site, size - old_size);
+    else
+        sub_bytes(nb->site, old_size - size);
+
+    return nb->payload;
 }
 
 // cppcheck-suppress unusedFunction
 char *test_strdup(const char *s)
+{
+    return test_strdup_at(s, &unknown_site);
+}
+
+char *test_strdup_at(const char *s, alloc_site_t *site)
 {
     size_t len = strlen(s) + 1;
-    void *new = test_malloc(len);
+    void *new = test_malloc_at(len, site);
     if (!new)
         return NULL;
 
@@ -223,7 +1068,188 @@ char *test_strdup(const char *s)
 
 size_t allocation_check()
 {
-    return allocated_count;
+    size_t count = 0;
+    lock_block_lists();
+    for (block_list_t *list = block_lists; list; list = list->next) {
+        bool locked = lock_list(list);
+        count += list->allocated_count;
+        unlock_list(list, locked);
+    }
+    pthread_mutex_unlock(&block_lists_lock);
+    return count;
+}
+
+void memory_stats(mem_stats_t *stats)
+{
+    memset(stats, 0, sizeof(mem_stats_t));
+    stats->peak_blocks = __atomic_load_n(&peak_blocks, __ATOMIC_RELAXED);
+    stats->peak_bytes = __atomic_load_n(&peak_bytes, __ATOMIC_RELAXED);
+
+    lock_block_lists();
+    for (block_list_t *list = block_lists; list; list = list->next) {
+        bool locked = lock_list(list);
+        for (block_ele_t *b = list->allocated; b; b = b->next) {
+            size_t size = b->payload_size;
+            stats->blocks++;
+            stats->bytes += size;
+            if (b->magic_header == MAGICGUARD) {
+                stats->overhead += guard_map_size(size) - size;
+            } else {
+                size_t room = size + sizeof(block_ele_t) + sizeof(size_t);
+                stats->overhead += room - size;
+                stats->slack += malloc_usable_size(b) - room;
+            }
+            int c = 0;
+            while (c < SIZE_CLASSES - 1 && size > (size_t) 8 << c)
+                c++;
+            stats->size_classes[c]++;
+        }
+        unlock_list(list, locked);
+    }
+    pthread_mutex_unlock(&block_lists_lock);
+
+    pthread_mutex_lock(&quarantine_lock);
+    stats->quarantined = quarantine_bytes;
+    pthread_mutex_unlock(&quarantine_lock);
+}
+
+/* Blocks still allocated that share a backtrace, or a site if they have none */
+typedef struct {
+    alloc_site_t *site;
+    backtrace_t *trace;
+    size_t blocks;
+    size_t bytes;
+} leak_t;
+
+static int cmp_leak_origin(const void *a, const void *b)
+{
+    const leak_t *la = a, *lb = b;
+    if (la->trace != lb->trace)
+        return (uintptr_t) la->trace < (uintptr_t) lb->trace ? -1 : 1;
+    if (la->site != lb->site)
+        return (uintptr_t) la->site < (uintptr_t) lb->site ? -1 : 1;
+    return 0;
+}
+
+static int cmp_leak_bytes(const void *a, const void *b)
+{
+    const leak_t *la = a, *lb = b;
+    return (la->bytes < lb->bytes) - (la->bytes > lb->bytes);
+}
+
+/*
+ * Print return address as function and offset where the symbol is exported,
+ * and as offset into its object, which addr2line turns into a source line
+ */
+static void report_frame(int i, void *addr)
+{
+    Dl_info info;
+    if (!dladdr(addr, &info) || !info.dli_fname) {
+        report(1, "\t#%d %p", i, addr);
+        return;
+    }
+    const char *object = strrchr(info.dli_fname, '/');
+    object = object ? object + 1 : info.dli_fname;
+    size_t offset = (uintptr_t) addr - (uintptr_t) info.dli_fbase;
+    if (info.dli_sname)
+        report(1, "\t#%d %s+%#lx (%s+%#lx)", i, info.dli_sname,
+               (uintptr_t) addr - (uintptr_t) info.dli_saddr, object, offset);
+    else
+        report(1, "\t#%d %s+%#lx", i, object, offset);
+}
+
+size_t report_leaks(size_t max_origins)
+{
+    lock_block_lists();
+    size_t size = 0;
+    for (block_list_t *list = block_lists; list; list = list->next) {
+        bool locked = lock_list(list);
+        size += list->allocated_count;
+        unlock_list(list, locked);
+    }
+    leak_t *leaks = size ? malloc(size * sizeof(leak_t)) : NULL;
+    size_t n = 0;
+    for (block_list_t *list = leaks ? block_lists : NULL; list;
+         list = list->next) {
+        bool locked = lock_list(list);
+        for (block_ele_t *b = list->allocated; b && n < size; b = b->next)
+            leaks[n++] = (leak_t){b->site, b->trace, 1, b->payload_size};
+        unlock_list(list, locked);
+    }
+    pthread_mutex_unlock(&block_lists_lock);
+    if (!n) {
+        free(leaks);
+        return 0;
+    }
+
+    /* Merge the blocks of each origin, then put the most bytes first */
+    qsort(leaks, n, sizeof(leak_t), cmp_leak_origin);
+    size_t origins = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (origins && !cmp_leak_origin(&leaks[origins - 1], &leaks[i])) {
+            leaks[origins - 1].blocks++;
+            leaks[origins - 1].bytes += leaks[i].bytes;
+        } else {
+            leaks[origins++] = leaks[i];
+        }
+    }
+    qsort(leaks, origins, sizeof(leak_t), cmp_leak_bytes);
+
+    for (size_t i = 0; i < origins && i < max_origins; i++) {
+        leak_t *l = &leaks[i];
+        if (l->site->file)
+            report(1, "Leaked %lu bytes in %lu blocks allocated at %s:%d (%s)",
+                   l->bytes, l->blocks, l->site->file, l->site->line,
+                   l->site->func);
+        else
+            report(1, "Leaked %lu bytes in %lu blocks allocated through %s",
+                   l->bytes, l->blocks, l->site->func);
+        for (int f = 0; l->trace && f < l->trace->depth; f++)
+            report_frame(f, l->trace->frames[f]);
+    }
+    if (origins > max_origins)
+        report(1, "... and %lu more origins of leaks", origins - max_origins);
+
+    free(leaks);
+    return n;
+}
+
+void set_profiling(bool on)
+{
+    profiling_on = on;
+}
+
+void set_histograms(bool on)
+{
+    histograms_on = on;
+}
+
+void allocation_histograms(alloc_histograms_t *h)
+{
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        h->sizes[i] = __atomic_load_n(&histograms.sizes[i], __ATOMIC_RELAXED);
+        h->lifetime_ns[i] =
+            __atomic_load_n(&histograms.lifetime_ns[i], __ATOMIC_RELAXED);
+        h->lifetime_ops[i] =
+            __atomic_load_n(&histograms.lifetime_ops[i], __ATOMIC_RELAXED);
+    }
+}
+
+void set_backtrace_depth(int depth)
+{
+    if (depth < 0)
+        depth = 0;
+    if (depth > MAX_BACKTRACE)
+        depth = MAX_BACKTRACE;
+    backtrace_depth = depth;
+}
+
+alloc_site_t *allocation_sites()
+{
+    pthread_mutex_lock(&sites_lock);
+    alloc_site_t *first = sites;
+    pthread_mutex_unlock(&sites_lock);
+    return first;
 }
 
 /*
@@ -240,7 +1266,146 @@ void set_cautious_mode(bool cautious)
 }
 
 /*
- * Set/unset restricted allocation mode.
+ * Set/unset guard mode.
+ * In this mode, every new block ends right before an inaccessible page.
+ */
+void set_guard_mode(bool guard)
+{
+    guard_mode = guard;
+}
+
+/*
+ * Set size from which blocks are no longer filled when allocated and freed.
+ * Zero fills all blocks.
+ */
+void set_fill_limit(size_t limit)
+{
+    fill_limit = limit;
+}
+
+/*
+ * Seed the random failures and start numbering allocations anew
+ */
+void set_fail_seed(unsigned seed)
+{
+    fail_seed = seed;
+    allocation_number = 0;
+}
+
+/*
+ * Make allocation n, counted from now, fail.  Zero fails none.
+ */
+void set_fail_nth(size_t n)
+{
+    allocation_number = 0;
+    fail_nth = n;
+    fail_nth_hit = false;
+}
+
+bool fail_nth_done()
+{
+    return fail_nth_hit;
+}
+
+/*
+ * Make every allocation of matching call sites fail.  NULL fails none.
+ */
+void set_fail_site(const char *spec)
+{
+    fail_site[0] = '\0';
+    if (spec)
+        strncat(fail_site, spec, SITE_SPEC_LEN - 1);
+}
+
+/*
+ * Set how many bytes of freed blocks the quarantine may hold.  Zero disables
+ * it.  Blocks beyond the new budget are released.
+ */
+void set_quarantine(size_t budget)
+{
+    pthread_mutex_lock(&quarantine_lock);
+    quarantine_budget = budget;
+    while (quarantine_bytes > quarantine_budget)
+        quarantine_release();
+    pthread_mutex_unlock(&quarantine_lock);
+}
+
+/*
+ * Release every block in quarantine, checking it was not written to
+ */
+void flush_quarantine()
+{
+    pthread_mutex_lock(&quarantine_lock);
+    while (quarantine_head)
+        quarantine_release();
+    pthread_mutex_unlock(&quarantine_lock);
+}
+
+/*
+ * Set time limit of risky operations in seconds, before scaling.
+ * Return the previous limit
+ */
+double set_time_limit(double seconds)
+{
+    double old = time_limit;
+    time_limit = seconds;
+    return old;
+}
+
+/*
+ * Return largest share of its time limit a risky operation of the calling
+ * thread used since last call
+ */
+double time_limit_used()
+{
+    double used = limit_used;
+    limit_used = 0;
+    return used;
+}
+
+/* Seconds it takes to allocate, touch and free a batch of small blocks */
+static double calibration_run(void **blocks)
+{
+    double start = now();
+    for (size_t i = 0; i < CALIBRATION_BLOCKS; i++) {
+        blocks[i] = malloc(64);
+        if (blocks[i])
+            memset(blocks[i], FILLCHAR, 64);
+    }
+    for (size_t i = 0; i < CALIBRATION_BLOCKS; i++)
+        free(blocks[i]);
+    return now() - start;
+}
+
+/*
+ * Scale time limits by how much slower than the reference machine this one
+ * runs a small allocation workload, and return the factor.
+ */
+double calibrate_time_limit()
+{
+    void **blocks = malloc(CALIBRATION_BLOCKS * sizeof(void *));
+    if (!blocks)
+        return time_scale;
+
+    /* The fastest of a few runs is the least disturbed one */
+    double best = calibration_run(blocks);
+    for (int i = 0; i < 4; i++) {
+        double t = calibration_run(blocks);
+        if (t < best)
+            best = t;
+    }
+    free(blocks);
+
+    time_scale = best / CALIBRATION_REFERENCE;
+    if (time_scale < 0.1)
+        time_scale = 0.1;
+    if (time_scale > 10)
+        time_scale = 10;
+    return time_scale;
+}
+
+/*
+ * Set/unset restricted allocation mode of the calling thread.
  * In this mode, calls to malloc and free are disallowed.
  */
 void set_noallocate_mode(bool noallocate)
@@ -253,9 +1418,47 @@ void set_noallocate_mode(bool noallocate)
  */
 bool error_check()
 {
-    bool e = error_occurred;
-    error_occurred = false;
-    return e;
+    return __atomic_exchange_n(&error_occurred, false, __ATOMIC_RELAXED);
+}
+
+/*
+ * Let SIGALRM hit the calling thread after given seconds, or never if zero.
+ * Falls back to alarm, in whole seconds, if no timer can be made.
+ */
+static void set_timer(double seconds)
+{
+    if (!limit_timer_made) {
+        struct sigevent sev = {.sigev_notify = SIGEV_THREAD_ID,
+                               .sigev_signo = SIGALRM};
+        sev.sigev_notify_thread_id = syscall(SYS_gettid);
+        limit_timer_made = !timer_create(CLOCK_MONOTONIC, &sev, &limit_timer);
+    }
+    if (!limit_timer_made) {
+        alarm(seconds > 0 ? (unsigned) seconds + 1 : 0);
+        return;
+    }
+
+    struct itimerspec its = {0};
+    if (seconds > 0) {
+        its.it_value.tv_sec = (time_t) seconds;
+        its.it_value.tv_nsec = (long) ((seconds - its.it_value.tv_sec) * 1e9);
+        /* Zero would disarm the timer */
+        if (!its.it_value.tv_sec && !its.it_value.tv_nsec)
+            its.it_value.tv_nsec = 1;
+    }
+    timer_settime(limit_timer, 0, &its, NULL);
+}
+
+/* Stop the time limit of the calling thread and note how much it used */
+static void end_time_limit()
+{
+    set_timer(0);
+    time_limited = false;
+    if (limit_seconds <= 0)
+        return;
+    double used = (now() - limit_start) / limit_seconds;
+    if (used > limit_used)
+        limit_used = used;
 }
 
 /*
@@ -267,10 +1470,8 @@ bool exception_setup(bool limit_time)
     if (sigsetjmp(env, 1)) {
         /* Got here from longjmp */
         jmp_ready = false;
-        if (time_limited) {
-            alarm(0);
-            time_limited = false;
-        }
+        if (time_limited)
+            end_time_limit();
 
         if (error_message)
             report_event(MSG_ERROR, error_message);
@@ -281,7 +1482,9 @@ bool exception_setup(bool limit_time)
     /* Got here from initial call */
     jmp_ready = true;
     if (limit_time) {
-        alarm(time_limit);
+        limit_seconds = time_limit * time_scale;
+        limit_start = now();
+        set_timer(limit_seconds);
         time_limited = true;
     }
     return true;
@@ -292,10 +1495,8 @@ bool exception_setup(bool limit_time)
  */
 void exception_cancel()
 {
-    if (time_limited) {
-        alarm(0);
-        time_limited = false;
-    }
+    if (time_limited)
+        end_time_limit();
 
     jmp_ready = false;
     error_message = "";
@@ -306,7 +1507,7 @@ void exception_cancel()
  */
 void trigger_exception(char *msg)
 {
-    error_occurred = true;
+    set_error();
     error_message = msg;
     if (jmp_ready)
         siglongjmp(env, 1);
@@ -9,22 +9,162 @@
  * This test harness enables us to do stringent testing of code.
  * It overloads the library versions of malloc and free with ones that
  * allow checking for common allocation errors.
+ *
+ * The allocation functions may be called from any thread, and a block may be
+ * freed by a thread other than the one that allocated it.  Exceptions are set
+ * up per thread, while errors and allocation counts cover all threads.
  */
 
+/*
+ * Allocation statistics of one call site.  The malloc and strdup macros
+ * below give every call site of the tested program one of these.
+ */
+typedef struct alloc_site {
+    const char *file;
+    int line;
+    const char *func;
+    /* Number of blocks allocated and freed, and bytes requested in total */
+    size_t allocs;
+    size_t frees;
+    size_t bytes;
+    /* Bytes in blocks currently allocated, and the most there ever were */
+    size_t live_bytes;
+    size_t peak_bytes;
+    /*
+     * Sum of the lifetimes of blocks allocated and freed while profiling, in
+     * seconds, and the number of them
+     */
+    double lifetime;
+    size_t timed_frees;
+    /*
+     * Number of realloc calls, how many of them had to move the block, and
+     * the bytes copied doing so
+     */
+    size_t reallocs;
+    size_t moves;
+    size_t copied_bytes;
+    /* Next site in the list of sites used so far */
+    struct alloc_site *next;
+    bool registered;
+} alloc_site_t;
+
 void *test_malloc(size_t size);
+void *test_malloc_at(size_t size, alloc_site_t *site);
 void *test_calloc(size_t nmemb, size_t size);
 void test_free(void *p);
 char *test_strdup(const char *s);
-/* FIXME: provide test_realloc as well */
+char *test_strdup_at(const char *s, alloc_site_t *site);
+void *test_realloc(void *p, size_t size);
+void *test_realloc_at(void *p, size_t size, alloc_site_t *site);
 
 #ifdef INTERNAL
 
-/* Report number of allocated blocks */
+/* Report number of blocks allocated by all threads */
 size_t allocation_check();
 
+/*
+ * Return the call sites that allocated blocks so far, linked through next.
+ * Blocks allocated through test_malloc itself count towards a site with a
+ * NULL file.
+ */
+alloc_site_t *allocation_sites();
+
+/*
+ * Record a backtrace of up to depth frames for every block allocated from now
+ * on, which report_leaks then prints.  Zero records none, which is the
+ * default.  The frames are found through the frame pointers, so only code
+ * built with them shows up.
+ */
+void set_backtrace_depth(int depth);
+
+/*
+ * Print the blocks still allocated, grouped by backtrace, or by call site for
+ * blocks without one, the origins holding the most bytes first and at most
+ * max_origins of them.  Return the number of blocks.
+ */
+size_t report_leaks(size_t max_origins);
+
+/*
+ * Turn timing of blocks on or off, which reading the clock on every malloc
+ * and free makes costly.  Sites count blocks and bytes either way, but sum
+ * only the lifetimes of blocks allocated and freed while it is on.  Off by
+ * default.
+ */
+void set_profiling(bool on);
+
+/* Number of buckets of alloc_histograms_t, the last one open-ended */
+#define HISTOGRAM_BUCKETS 48
+
+/*
+ * Histograms of blocks allocated while histograms are on.  Bucket i counts
+ * values from 2^(i-1) up to 2^i - 1, and bucket 0 counts zeros.
+ */
+typedef struct {
+    /* Blocks allocated by size in bytes */
+    size_t sizes[HISTOGRAM_BUCKETS];
+    /*
+     * Blocks freed by lifetime, in nanoseconds, and in calls of malloc,
+     * realloc and free made meanwhile
+     */
+    size_t lifetime_ns[HISTOGRAM_BUCKETS];
+    size_t lifetime_ops[HISTOGRAM_BUCKETS];
+} alloc_histograms_t;
+
+/*
+ * Turn collection of histograms on or off.  They accumulate over the whole
+ * run, and blocks allocated while off are left out of them.
+ */
+void set_histograms(bool on);
+
+/* Copy the histograms collected so far into h */
+void allocation_histograms(alloc_histograms_t *h);
+
+/* Number of size classes of mem_stats_t, the last one open-ended */
+#define SIZE_CLASSES 16
+
+/* Memory held by the blocks allocated by all threads */
+typedef struct {
+    /* Blocks and bytes allocated now, and the most there ever were */
+    size_t blocks;
+    size_t bytes;
+    size_t peak_blocks;
+    size_t peak_bytes;
+    /* Bytes the harness adds for headers, footers and guard pages */
+    size_t overhead;
+    /* Bytes malloc rounds the blocks up by */
+    size_t slack;
+    /* Bytes of freed blocks held in quarantine */
+    size_t quarantined;
+    /* Number of blocks of at most 8 << i bytes for class i */
+    size_t size_classes[SIZE_CLASSES];
+} mem_stats_t;
+
+/* Gather statistics of the blocks allocated by all threads */
+void memory_stats(mem_stats_t *stats);
+
 /* Probability of malloc failing, expressed as percent */
 extern int fail_probability;
 
+/*
+ * Seed the failures drawn with fail_probability.  Allocations are numbered
+ * from here on, and whether one fails depends on the seed and its number
+ * only, so the same seed and commands fail the same allocations again.
+ */
+void set_fail_seed(unsigned seed);
+
+/*
+ * Make allocation n, counted from now, fail.  Zero fails none.
+ * fail_nth_done() tells whether the program got as far as allocation n.
+ */
+void set_fail_nth(size_t n);
+bool fail_nth_done();
+
+/*
+ * Make every allocation of a call site fail.  The site is given as the name
+ * of the calling function, or as file:line.  NULL fails none.
+ */
+void set_fail_site(const char *spec);
+
 /*
  * Set/unset cautious mode.
  * In this mode, makes extra sure any block to be freed is currently allocated.
@@ -32,8 +172,37 @@ extern int fail_probability;
 void set_cautious_mode(bool cautious);
 
 /*
- * Set/unset restricted allocation mode.
- * In this mode, calls to malloc and free are disallowed.
+ * Set/unset guard mode.
+ * In this mode, every new block is mapped to end right before an inaccessible
+ * page, so that writing or reading past its end faults at once.  Each block
+ * then takes at least two pages, which limits the mode to small tests.
+ */
+void set_guard_mode(bool guard);
+
+/*
+ * Set size from which blocks are no longer filled when allocated and freed.
+ * Skipping the fill makes large blocks cheap at the cost of not exposing
+ * uses of uninitialized or freed memory in them.  Zero fills all blocks.
+ */
+void set_fill_limit(size_t limit);
+
+/*
+ * Set how many bytes of freed blocks are held in quarantine.  Freed blocks
+ * then stay poisoned and out of reach of malloc for a while, and are checked
+ * to be still poisoned when released, which exposes writes after free.
+ * Blocks are released oldest first once the budget is exceeded.  Zero
+ * disables the quarantine, which is the default.
+ */
+void set_quarantine(size_t budget);
+
+/*
+ * Release every block in quarantine, reporting those written after free
+ */
+void flush_quarantine();
+
+/*
+ * Set/unset restricted allocation mode of the calling thread.
+ * In this mode, calls to malloc and free by that thread are disallowed.
  */
 void set_noallocate_mode(bool noallocate);
 
@@ -43,11 +212,31 @@ void set_noallocate_mode(bool noallocate);
 bool error_check();
 
 /*
- * Prepare for a risky operation using setjmp.
- * Function returns true for initial return, false for error return
+ * Prepare for a risky operation of the calling thread using setjmp.
+ * Function returns true for initial return, false for error return.
+ * With limit_time set, SIGALRM hits the calling thread once the operation
+ * takes longer than the time limit.
  */
 bool exception_setup(bool limit_time);
 
+/*
+ * Set time limit of risky operations in seconds, one by default.
+ * Return the previous limit
+ */
+double set_time_limit(double seconds);
+
+/*
+ * Return largest share of its time limit a risky operation of the calling
+ * thread used since last call, where 1 means it ran out of time
+ */
+double time_limit_used();
+
+/*
+ * Scale time limits to the speed of this machine, measured with a small
+ * allocation workload against a reference machine.  Return the factor.
+ */
+double calibrate_time_limit();
+
 /*
  * Call once past risky code
  */
@@ -60,13 +249,24 @@ void trigger_exception(char *msg);
 
 #else /* !INTERNAL */
 
-/* Tested program use our versions of malloc and free */
-#define malloc test_malloc
+/*
+ * Tested program use our versions of malloc, realloc and free.  Each call of
+ * malloc, realloc and strdup gets its own statistics, see alloc_site_t.
+ */
+#define ALLOC_SITE_AT(call)                                           \
+    ({                                                                \
+        static alloc_site_t site_ = {.file = __FILE__,                \
+                                     .line = __LINE__,                \
+                                     .func = __func__};               \
+        call;                                                         \
+    })
+#define malloc(size) ALLOC_SITE_AT(test_malloc_at(size, &site_))
+#define realloc(p, size) ALLOC_SITE_AT(test_realloc_at(p, size, &site_))
 #define free test_free
 
 /* Use undef to avoid strdup redefined error */
 #undef strdup
-#define strdup test_strdup
+#define strdup(s) ALLOC_SITE_AT(test_strdup_at(s, &site_))
 
 #endif
 
@@ -2,6 +2,8 @@
 
 #include <errno.h>
 #include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
 #include <signal.h>
 #include <spawn.h>
 #include <stdio.h>
@@ -32,6 +34,7 @@
  * solution code
  */
 #include "queue.h"
+#include "typed.h"
 
 #include "console.h"
 #include "report.h"
@@ -42,8 +45,7 @@
 
 /*
  * How large is a queue before it's considered big.
- * This affects how it gets printed
- * and whether cautious mode is used when freeing the queue
+ * This only affects how it gets printed
  */
 #define BIG_LIST 30
 static int big_list_size = BIG_LIST;
@@ -56,6 +58,10 @@ typedef struct {
     struct list_head *l;
     /* meta data of list */
     int size;
+    /* Elements are carved from an arena, see q_new_arena() */
+    bool arena;
+    /* Elements may come from a recycle cache, see q_set_recycle() */
+    bool recycle;
 } list_head_meta_t;
 
 static list_head_meta_t l_meta;
@@ -63,12 +69,69 @@ static list_head_meta_t l_meta;
 /* Number of elements in queue */
 static size_t lcnt = 0;
 
+/* Snapshot taken by clone, sharing strings with the queue being tested */
+static struct list_head *l_snap = NULL;
+static size_t snap_cnt = 0;
+
+/* Blocks held by the copies the oom command starts its runs from */
+static size_t oom_blocks = 0;
+
 /* How many times can queue operations fail */
 static int fail_limit = BIG_LIST;
 static int fail_count = 0;
 
 static int string_length = MAXSTRING;
 
+/* Whether new queues are arena-backed */
+static int arena_mode = 0;
+
+/* Whether q_free leaves the work to the reclamation thread */
+static int deferred_free = 0;
+
+/* How many released elements the queue may cache for reuse */
+static int recycle_limit = 0;
+
+/* Seed of the random malloc failures */
+static int fail_seed = 0;
+
+/* Number of the allocation to fail, counted from when it is set */
+static int fail_nth = 0;
+
+/* Whether new blocks are placed in front of guard pages */
+static int guard_mode = 0;
+
+/* Size from which blocks are no longer filled, or 0 to fill all */
+static int nofill_size = 0;
+
+/* Bytes of freed blocks held in quarantine, or 0 for none */
+static int quarantine_budget = 0;
+
+/* Frames of backtrace recorded per allocation, or 0 for none */
+static int backtrace_depth = 0;
+
+/* Whether blocks are timed for the lifetimes shown by allocs */
+static int profile_mode = 0;
+
+/* Whether histograms of block sizes and lifetimes are collected */
+static int histogram_mode = 0;
+
+/* Most origins of leaked blocks shown */
+#define LEAK_ORIGINS 10
+
+/* Time limit of commands without a budget in milliseconds, or 0 for none */
+static int time_limit_ms = 1000;
+
+/* Set through QTEST_NO_TIMELIMIT to run without any, as under valgrind */
+static bool no_time_limit = false;
+
+/*
+ * Budgets of the commands being run, outermost first, as commands like
+ * source and oom run others
+ */
+#define MAX_NESTING 8
+static int budget_stack[MAX_NESTING];
+static int nesting = 0;
+
 #define MIN_RANDSTR_LEN 5
 #define MAX_RANDSTR_LEN 10
 static const char charset[] = "abcdefghijklmnopqrstuvwxyz";
@@ -76,6 +139,128 @@ static const char charset[] = "abcdefghijklmnopqrstuvwxyz";
 /* Forward declarations */
 static bool show_queue(int vlevel);
 
+static void set_deferred_free(int oldval)
+{
+    q_set_deferred_free(deferred_free);
+}
+
+static void set_seed(int oldval)
+{
+    set_fail_seed(fail_seed);
+}
+
+static void set_nth(int oldval)
+{
+    if (fail_nth < 0)
+        fail_nth = 0;
+    set_fail_nth(fail_nth);
+}
+
+static void set_guard(int oldval)
+{
+    set_guard_mode(guard_mode);
+}
+
+static void set_nofill(int oldval)
+{
+    if (nofill_size < 0)
+        nofill_size = 0;
+    set_fill_limit(nofill_size);
+}
+
+static void set_quarantine_budget(int oldval)
+{
+    if (quarantine_budget < 0)
+        quarantine_budget = 0;
+    set_quarantine(quarantine_budget);
+}
+
+static void set_profile(int oldval)
+{
+    set_profiling(profile_mode);
+}
+
+static void set_histogram(int oldval)
+{
+    set_histograms(histogram_mode);
+}
+
+static void set_backtrace(int oldval)
+{
+    set_backtrace_depth(backtrace_depth);
+}
+
+/* Let queue operations take up to ms milliseconds, or forever if zero */
+static void apply_time_limit(int ms)
+{
+    set_time_limit(no_time_limit ? 0 : ms / 1000.0);
+}
+
+static void set_timelimit(int oldval)
+{
+    if (time_limit_ms < 0)
+        time_limit_ms = 0;
+    apply_time_limit(time_limit_ms);
+}
+
+/* Limit time of the operations of a command to its budget, if it has one */
+static void before_command(const char *name, int budget)
+{
+    if (nesting == 0)
+        time_limit_used();
+    if (nesting < MAX_NESTING)
+        budget_stack[nesting] = budget;
+    nesting++;
+    apply_time_limit(budget ? budget : time_limit_ms);
+}
+
+/* Restore time limit of enclosing command, and report how much was used */
+static void after_command(const char *name, int budget)
+{
+    nesting--;
+    int outer = 0;
+    if (nesting > 0 && nesting <= MAX_NESTING)
+        outer = budget_stack[nesting - 1];
+    apply_time_limit(outer ? outer : time_limit_ms);
+    if (nesting > 0)
+        return;
+
+    /* Commands far from their limit are not worth mentioning */
+    double used = time_limit_used();
+    if (used >= 0.1)
+        report(used >= 0.5 ? 2 : 3, "%s used %.0f%% of its time limit", name,
+               100 * used);
+}
+
+static void set_recycle(int oldval)
+{
+    if (recycle_limit < 0)
+        recycle_limit = 0;
+    if (!l_meta.l)
+        return;
+
+    bool ok = false;
+    if (exception_setup(true))
+        ok = q_set_recycle(l_meta.l, recycle_limit);
+    exception_cancel();
+    if (ok && recycle_limit)
+        l_meta.recycle = true;
+}
+
+static void free_snapshot()
+{
+    if (!l_snap)
+        return;
+
+    if (exception_setup(true))
+        q_free(l_snap);
+    exception_cancel();
+    q_free_sync();
+
+    l_snap = NULL;
+    snap_cnt = 0;
+}
+
 static bool do_free(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -88,22 +273,25 @@ static bool do_free(int argc, char *argv[])
         report(3, "Warning: Calling free on null queue");
     error_check();
 
-    if (lcnt > big_list_size)
-        set_cautious_mode(false);
+    free_snapshot();
+
     if (exception_setup(true))
         q_free(l_meta.l);
     exception_cancel();
-    set_cautious_mode(true);
+    /* A deferred free runs outside the time limit, but must finish first */
+    q_free_sync();
+    flush_quarantine();
 
     l_meta.size = 0;
     l_meta.l = NULL;
     lcnt = 0;
     show_queue(3);
 
-    size_t bcnt = allocation_check();
+    size_t bcnt = allocation_check() - oom_blocks;
     if (bcnt > 0) {
         report(1, "ERROR: Freed queue, but %lu blocks are still allocated",
                bcnt);
+        report_leaks(LEAK_ORIGINS);
         ok = false;
     }
 
@@ -125,8 +313,13 @@ static bool do_new(int argc, char *argv[])
     error_check();
 
     if (exception_setup(true)) {
-        l_meta.l = q_new();
+        l_meta.arena = arena_mode;
+        l_meta.recycle = false;
+        l_meta.l = arena_mode ? q_new_arena() : q_new();
         l_meta.size = 0;
+        if (l_meta.l && recycle_limit &&
+            q_set_recycle(l_meta.l, recycle_limit))
+            l_meta.recycle = true;
     }
     exception_cancel();
     lcnt = 0;
@@ -195,6 +388,8 @@ static bool do_ih(int argc, char *argv[])
     error_check();
 
     if (exception_setup(true)) {
+        /* The checks below look at the new element through raw links */
+        q_materialize(l_meta.l);
         for (int r = 0; ok && r < reps; r++) {
             if (need_rand)
                 fill_rand_string(randstr_buf, sizeof(randstr_buf));
@@ -284,6 +479,8 @@ static bool do_it(int argc, char *argv[])
     error_check();
 
     if (exception_setup(true)) {
+        /* The checks below look at the new element through raw links */
+        q_materialize(l_meta.l);
         for (int r = 0; ok && r < reps; r++) {
             if (need_rand)
                 fill_rand_string(randstr_buf, sizeof(randstr_buf));
@@ -318,14 +515,15 @@ static bool do_it(int argc, char *argv[])
 
 static bool do_remove(int option, int argc, char *argv[])
 {
-    // option 0 is for remove head; option 1 is for remove tail
+    // option 0 is for remove head; option 1 is for remove tail;
+    // option 2 is for removing the smallest element of a priority queue
 
     /* FIXME: It is known that both functions is_remove_tail_const() and
      * is_remove_head_const() can not pass dudect on Arm64. We shall figure
      * out the exact reasons and resolve later.
      */
 #if !defined(__aarch64__)
-    if (simulation) {
+    if (simulation && option < 2) {
         if (argc != 1) {
             report(1, "%s does not need arguments in simulation mode", argv[0]);
             return false;
@@ -376,14 +574,27 @@ static bool do_remove(int option, int argc, char *argv[])
     error_check();
 
     element_t *re = NULL;
-    if (exception_setup(true))
-        re = option ? q_remove_tail(l_meta.l, removes, string_length + 1)
-                    : q_remove_head(l_meta.l, removes, string_length + 1);
+    if (exception_setup(true)) {
+        if (option == 2)
+            re = q_pq_pop_min(l_meta.l, removes, string_length + 1);
+        else if (option)
+            re = q_remove_tail(l_meta.l, removes, string_length + 1);
+        else
+            re = q_remove_head(l_meta.l, removes, string_length + 1);
+    }
     exception_cancel();
 
     bool is_null = re ? false : true;
 
     if (!is_null) {
+        if (re->len != strlen(re->value)) {
+            report(1,
+                   "ERROR: Removed element records length %lu for %lu "
+                   "characters",
+                   re->len, strlen(re->value));
+            ok = false;
+        }
+
         // q_remove_head and q_remove_tail are not responsible for releasing
         // node
         q_release_element(re);
@@ -445,139 +656,486 @@ static inline bool do_rt(int argc, char *argv[])
     return do_remove(1, argc, argv);
 }
 
-/* remove head quietly */
-static bool do_rhq(int argc, char *argv[])
+static inline bool do_pqpop(int argc, char *argv[])
 {
-    if (argc != 1) {
-        report(1, "%s takes no arguments", argv[0]);
-        return false;
-    }
+    return do_remove(2, argc, argv);
+}
 
+/* insert strings handed over to the queue without copying */
+static bool do_insert_owned(bool tail, int argc, char *argv[])
+{
+    int reps = 1;
     bool ok = true;
-    if (!l_meta.size)
-        report(3, "Warning: Calling remove head on empty queue");
-    error_check();
-
-    element_t *re = NULL;
+    if (argc != 2 && argc != 3) {
+        report(1, "%s needs 1-2 arguments", argv[0]);
+        return false;
+    }
 
-    if (exception_setup(true))
-        re = q_remove_head(l_meta.l, NULL, 0);
-    exception_cancel();
+    char *inserts = argv[1];
+    if (argc == 3) {
+        if (!get_int(argv[2], &reps)) {
+            report(1, "Invalid number of insertions '%s'", argv[2]);
+            return false;
+        }
+    }
 
-    if (re) {
-        // q_remove_head and q_remove_tail are not responsible for releasing
-        // node
-        q_release_element(re);
+    if (!l_meta.l)
+        report(3, "Warning: Calling insert on null queue");
+    error_check();
 
-        report(2, "Removed element from queue");
-        lcnt--;
-        l_meta.size--;
-    } else {
-        fail_count++;
-        if (fail_count < fail_limit)
-            report(2, "Removal failed");
-        else {
-            report(1, "ERROR: Removal failed (%d failures total)", fail_count);
-            ok = false;
+    size_t len = strlen(inserts);
+    if (exception_setup(true)) {
+        /* The checks below look at the new element through raw links */
+        q_materialize(l_meta.l);
+        for (int r = 0; ok && r < reps; r++) {
+            char *s = q_new_string(len);
+            if (s)
+                memcpy(s, inserts, len);
+            bool rval = s && (tail ? q_insert_tail_owned(l_meta.l, s)
+                                   : q_insert_head_owned(l_meta.l, s));
+            if (rval) {
+                lcnt++;
+                l_meta.size++;
+                struct list_head *node = tail ? l_meta.l->prev : l_meta.l->next;
+                element_t *e = list_entry(node, element_t, list);
+                if (e->value != s) {
+                    report(1,
+                           "ERROR: Need to adopt string for new queue element "
+                           "instead of copying it");
+                    ok = false;
+                } else if (e->len != len) {
+                    report(1,
+                           "ERROR: Adopted string of length %lu recorded as "
+                           "%lu",
+                           len, e->len);
+                    ok = false;
+                }
+            } else {
+                /* The caller keeps ownership when insertion fails */
+                q_free_string(s);
+                fail_count++;
+                if (fail_count < fail_limit)
+                    report(2, "Insertion of %s failed", inserts);
+                else {
+                    report(1,
+                           "ERROR: Insertion of %s failed (%d failures total)",
+                           inserts, fail_count);
+                    ok = false;
+                }
+            }
+            ok = ok && !error_check();
         }
     }
+    exception_cancel();
 
     show_queue(3);
-    return ok && !error_check();
+    return ok;
 }
 
-static bool do_dedup(int argc, char *argv[])
+static inline bool do_iho(int argc, char *argv[])
 {
-    if (argc != 1) {
-        report(1, "%s takes no arguments", argv[0]);
+    return do_insert_owned(false, argc, argv);
+}
+
+static inline bool do_ito(int argc, char *argv[])
+{
+    return do_insert_owned(true, argc, argv);
+}
+
+/* remove without copying, then take over the string of the element */
+static bool do_remove_view(bool tail, int argc, char *argv[])
+{
+    if (argc != 1 && argc != 2) {
+        report(1, "%s needs 0-1 arguments", argv[0]);
         return false;
     }
 
-    bool ok = true;
-    // set_noallocate_mode(true);
+    if (!l_meta.size)
+        report(3, "Warning: Calling remove on empty queue");
+    error_check();
+
+    /*
+     * Queues freed in the background may share strings too.  Whether the
+     * removed element shares its string shows in the count of shared ones.
+     */
+    q_free_sync();
+    int shared = q_shared(l_meta.l);
+
+    element_t *re = NULL;
     if (exception_setup(true))
-        ok = q_delete_dup(l_meta.l);
+        re = tail ? q_remove_tail_view(l_meta.l) : q_remove_head_view(l_meta.l);
     exception_cancel();
 
-    // set_noallocate_mode(false);
-
-    if (!ok) {
-        report(1, "ERROR: Calling delete duplicate on null queue");
-        return false;
+    bool ok = true;
+    if (!re) {
+        fail_count++;
+        if (argc == 1 && fail_count < fail_limit) {
+            report(2, "Removal from queue failed");
+        } else {
+            report(1, "ERROR: Removal from queue failed (%d failures total)",
+                   fail_count);
+            ok = false;
+        }
+        show_queue(3);
+        return ok && !error_check();
     }
 
-    element_t *item = NULL;
-    if (l_meta.size) {
-        list_for_each_entry (item, l_meta.l, list) {
-            element_t *next_item;
-            if (item->list.next == l_meta.l)
-                break;
-            next_item = list_entry(item->list.next, element_t, list);
+    lcnt--;
+    l_meta.size--;
+    shared = shared > q_shared(l_meta.l);
+    char *value = re->value;
+    size_t len = re->len;
+    if (re->len != strlen(value)) {
+        report(1,
+               "ERROR: Removed element records length %lu for %lu "
+               "characters",
+               re->len, strlen(value));
+        ok = false;
+    } else if (argc == 2 && strcmp(value, argv[1])) {
+        report(1, "ERROR: Removed value %s != expected value %s", value,
+               argv[1]);
+        ok = false;
+    }
 
-            // assume queue has been sorted
-            if (strcmp(item->value, next_item->value) == 0) {
-                report(1, "ERROR: Contain duplicate string on queue");
-                ok = false;
-                break;
-            }
+    /*
+     * The string must outlive the element it is taken from.  Strings bound to
+     * their element or shared with another one are copied, and the element
+     * may be gone afterwards.
+     */
+    char *taken = q_take_value(re);
+    if (!taken) {
+        report(2, "Could not take value of removed element");
+        q_release_element(re);
+    } else {
+        if (!l_meta.arena && !l_meta.recycle && !shared && taken != value) {
+            report(1,
+                   "ERROR: Taking value of removed element should not copy "
+                   "it");
+            ok = false;
+        } else if (shared && taken == value) {
+            report(1, "ERROR: Taking shared value should copy it");
+            ok = false;
+        } else if (strlen(taken) != len ||
+                   (ok && argc == 2 && strcmp(taken, argv[1]))) {
+            report(1, "ERROR: Taken value %s differs from removed value",
+                   taken);
+            ok = false;
+        } else {
+            report(2, "Removed %s from queue", taken);
         }
+        /* The string is ours now, so writing it must not change any queue */
+        memset(taken, '*', strlen(taken));
+        q_free_string(taken);
     }
-    show_queue(3);
 
+    show_queue(3);
     return ok && !error_check();
 }
 
-static bool do_reverse(int argc, char *argv[])
+static inline bool do_rhv(int argc, char *argv[])
 {
-    if (argc != 1) {
-        report(1, "%s takes no arguments", argv[0]);
-        return false;
-    }
-
-    if (!l_meta.l)
-        report(3, "Warning: Calling reverse on null queue");
-    error_check();
-
-    set_noallocate_mode(true);
-    if (exception_setup(true))
-        q_reverse(l_meta.l);
-    exception_cancel();
-
-    set_noallocate_mode(false);
-    show_queue(3);
-    return !error_check();
+    return do_remove_view(false, argc, argv);
 }
 
-static bool do_size(int argc, char *argv[])
+static inline bool do_rtv(int argc, char *argv[])
 {
-    if (argc != 1 && argc != 2) {
-        report(1, "%s takes 0-1 arguments", argv[0]);
-        return false;
-    }
+    return do_remove_view(true, argc, argv);
+}
 
+/* push into priority queue */
+static bool do_pqpush(int argc, char *argv[])
+{
+    char randstr_buf[MAX_RANDSTR_LEN];
     int reps = 1;
-    bool ok = true;
-    if (argc != 1 && argc != 2) {
-        report(1, "%s needs 0-1 arguments", argv[0]);
+    bool ok = true, need_rand = false;
+    if (argc != 2 && argc != 3) {
+        report(1, "%s needs 1-2 arguments", argv[0]);
         return false;
     }
 
-    if (argc == 2) {
-        if (!get_int(argv[1], &reps)) {
-            report(1, "Invalid number of calls to size '%s'", argv[2]);
+    char *inserts = argv[1];
+    if (argc == 3) {
+        if (!get_int(argv[2], &reps)) {
+            report(1, "Invalid number of insertions '%s'", argv[2]);
+            return false;
         }
     }
 
-    int cnt = 0;
+    if (!strcmp(inserts, "RAND")) {
+        need_rand = true;
+        inserts = randstr_buf;
+    }
+
     if (!l_meta.l)
-        report(3, "Warning: Calling size on null queue");
+        report(3, "Warning: Calling push on null queue");
     error_check();
 
     if (exception_setup(true)) {
         for (int r = 0; ok && r < reps; r++) {
-            cnt = q_size(l_meta.l);
-            ok = ok && !error_check();
-        }
+            if (need_rand)
+                fill_rand_string(randstr_buf, sizeof(randstr_buf));
+            bool rval = q_pq_push(l_meta.l, inserts);
+            if (rval) {
+                lcnt++;
+                l_meta.size++;
+                element_t *min = q_pq_peek(l_meta.l);
+                if (!min || !min->value) {
+                    report(1, "ERROR: Failed to save copy of string in queue");
+                    ok = false;
+                } else if (strcmp(min->value, inserts) > 0) {
+                    report(1,
+                           "ERROR: Smallest element %s is larger than pushed "
+                           "string %s",
+                           min->value, inserts);
+                    ok = false;
+                }
+            } else {
+                fail_count++;
+                if (fail_count < fail_limit)
+                    report(2, "Insertion of %s failed", inserts);
+                else {
+                    report(1,
+                           "ERROR: Insertion of %s failed (%d failures total)",
+                           inserts, fail_count);
+                    ok = false;
+                }
+            }
+            ok = ok && !error_check();
+        }
+    }
+    exception_cancel();
+
+    show_queue(3);
+    return ok;
+}
+
+/* pop every element of priority queue, checking the order */
+static bool do_pqdrain(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    char *removes = malloc(string_length + 1);
+    char *lasts = malloc(string_length + 1);
+    if (!removes || !lasts) {
+        report(1,
+               "INTERNAL ERROR.  Could not allocate space for removed strings");
+        free(removes);
+        free(lasts);
+        return false;
+    }
+    lasts[0] = '\0';
+
+    if (!l_meta.l)
+        report(3, "Warning: Calling drain on null queue");
+    error_check();
+
+    bool ok = true;
+    size_t cnt = lcnt;
+    if (exception_setup(true)) {
+        element_t *e;
+        while (ok && (e = q_pq_pop_min(l_meta.l, removes, string_length + 1))) {
+            q_release_element(e);
+            lcnt--;
+            l_meta.size--;
+            if (strcmp(lasts, removes) > 0) {
+                report(1, "ERROR: Popped %s after %s, not in ascending order",
+                       removes, lasts);
+                ok = false;
+            }
+            strncpy(lasts, removes, string_length + 1);
+        }
+    } else {
+        ok = false;
+    }
+    exception_cancel();
+
+    if (ok && lcnt) {
+        report(1, "ERROR: Priority queue still holds %d elements after drain",
+               (int) lcnt);
+        ok = false;
+    }
+    report(2, "Drained %d elements", (int) (cnt - lcnt));
+
+    free(removes);
+    free(lasts);
+    show_queue(3);
+    return ok && !error_check();
+}
+
+/* meld snapshot into priority queue */
+static bool do_pqmeld(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!l_snap) {
+        report(1, "No snapshot to meld.  Use clone first");
+        return false;
+    }
+    error_check();
+
+    set_noallocate_mode(true);
+    if (exception_setup(true))
+        q_pq_meld(l_meta.l, l_snap);
+    exception_cancel();
+    set_noallocate_mode(false);
+
+    bool ok = true;
+    if (l_meta.l) {
+        if (q_size(l_snap)) {
+            report(1, "ERROR: Snapshot still holds %d elements after meld",
+                   q_size(l_snap));
+            ok = false;
+        } else {
+            lcnt += snap_cnt;
+            l_meta.size += snap_cnt;
+            snap_cnt = 0;
+        }
+    }
+    free_snapshot();
+
+    show_queue(3);
+    return ok && !error_check();
+}
+
+/* remove head quietly */
+static bool do_rhq(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    bool ok = true;
+    if (!l_meta.size)
+        report(3, "Warning: Calling remove head on empty queue");
+    error_check();
+
+    element_t *re = NULL;
+
+    if (exception_setup(true))
+        re = q_remove_head(l_meta.l, NULL, 0);
+    exception_cancel();
+
+    if (re) {
+        // q_remove_head and q_remove_tail are not responsible for releasing
+        // node
+        q_release_element(re);
+
+        report(2, "Removed element from queue");
+        lcnt--;
+        l_meta.size--;
+    } else {
+        fail_count++;
+        if (fail_count < fail_limit)
+            report(2, "Removal failed");
+        else {
+            report(1, "ERROR: Removal failed (%d failures total)", fail_count);
+            ok = false;
+        }
+    }
+
+    show_queue(3);
+    return ok && !error_check();
+}
+
+static bool do_dedup(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    bool ok = true;
+    // set_noallocate_mode(true);
+    if (exception_setup(true))
+        ok = q_delete_dup(l_meta.l);
+    exception_cancel();
+
+    // set_noallocate_mode(false);
+
+    if (!ok) {
+        report(1, "ERROR: Calling delete duplicate on null queue");
+        return false;
+    }
+
+    /* Duplicates have been released, so count the remaining elements */
+    element_t *item = NULL;
+    lcnt = 0;
+    list_for_each_entry (item, l_meta.l, list) {
+        lcnt++;
+        if (!ok || item->list.next == l_meta.l)
+            continue;
+
+        element_t *next_item = list_entry(item->list.next, element_t, list);
+        // assume queue has been sorted
+        if (strcmp(item->value, next_item->value) == 0) {
+            report(1, "ERROR: Contain duplicate string on queue");
+            ok = false;
+        }
+    }
+    l_meta.size = lcnt;
+    show_queue(3);
+
+    return ok && !error_check();
+}
+
+static bool do_reverse(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!l_meta.l)
+        report(3, "Warning: Calling reverse on null queue");
+    error_check();
+
+    set_noallocate_mode(true);
+    if (exception_setup(true))
+        q_reverse(l_meta.l);
+    exception_cancel();
+
+    set_noallocate_mode(false);
+    show_queue(3);
+    return !error_check();
+}
+
+static bool do_size(int argc, char *argv[])
+{
+    if (argc != 1 && argc != 2) {
+        report(1, "%s takes 0-1 arguments", argv[0]);
+        return false;
+    }
+
+    int reps = 1;
+    bool ok = true;
+    if (argc != 1 && argc != 2) {
+        report(1, "%s needs 0-1 arguments", argv[0]);
+        return false;
+    }
+
+    if (argc == 2) {
+        if (!get_int(argv[1], &reps)) {
+            report(1, "Invalid number of calls to size '%s'", argv[2]);
+        }
+    }
+
+    int cnt = 0;
+    if (!l_meta.l)
+        report(3, "Warning: Calling size on null queue");
+    error_check();
+
+    if (exception_setup(true)) {
+        for (int r = 0; ok && r < reps; r++) {
+            cnt = q_size(l_meta.l);
+            ok = ok && !error_check();
+        }
     }
     exception_cancel();
 
@@ -593,93 +1151,928 @@ static bool do_size(int argc, char *argv[])
     }
 
     show_queue(3);
-
+
+    return ok && !error_check();
+}
+
+bool do_sort(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!l_meta.l)
+        report(3, "Warning: Calling sort on null queue");
+    error_check();
+
+    int cnt = q_size(l_meta.l);
+    if (cnt < 2)
+        report(3, "Warning: Calling sort on single node");
+    error_check();
+
+    set_noallocate_mode(true);
+    if (exception_setup(true))
+        q_sort(l_meta.l);
+    exception_cancel();
+    set_noallocate_mode(false);
+
+    bool ok = true;
+    if (l_meta.size) {
+        for (struct list_head *cur_l = l_meta.l->next;
+             cur_l != l_meta.l && --cnt; cur_l = cur_l->next) {
+            /* Ensure each element in ascending order */
+            /* FIXME: add an option to specify sorting order */
+            element_t *item, *next_item;
+            item = list_entry(cur_l, element_t, list);
+            next_item = list_entry(cur_l->next, element_t, list);
+            if (strcasecmp(item->value, next_item->value) > 0) {
+                report(1, "ERROR: Not sorted in ascending order");
+                ok = false;
+                break;
+            }
+        }
+    }
+
+    show_queue(3);
+    return ok && !error_check();
+}
+
+/*
+ * Check that the element at index n splits the queue: nothing before it is
+ * larger and nothing after it is smaller.  If sorted is set, the elements up
+ * to index n must also be in ascending order.
+ */
+static bool check_selection(int n, bool sorted, element_t **nth)
+{
+    q_materialize(l_meta.l);
+    struct list_head *cur = l_meta.l->next;
+    for (int i = 0; i < n; i++)
+        cur = cur->next;
+    element_t *pivot = list_entry(cur, element_t, list);
+    *nth = pivot;
+
+    int i = 0;
+    element_t *item = NULL, *prev = NULL;
+    list_for_each_entry (item, l_meta.l, list) {
+        int r = strcmp(item->value, pivot->value);
+        if ((i < n && r > 0) || (i > n && r < 0)) {
+            report(1, "ERROR: Element %s at index %d is on wrong side of %s",
+                   item->value, i, pivot->value);
+            return false;
+        }
+        if (sorted && prev && i <= n &&
+            strcmp(prev->value, item->value) > 0) {
+            report(1, "ERROR: Not sorted in ascending order");
+            return false;
+        }
+        prev = item;
+        i++;
+    }
+    return true;
+}
+
+static bool do_nth(int argc, char *argv[])
+{
+    if (argc != 2 && argc != 3) {
+        report(1, "%s needs 1-2 arguments", argv[0]);
+        return false;
+    }
+
+    int n = 0;
+    if (!get_int(argv[1], &n)) {
+        report(1, "Invalid index '%s'", argv[1]);
+        return false;
+    }
+
+    if (!l_meta.l)
+        report(3, "Warning: Calling nth on null queue");
+    error_check();
+
+    element_t *e = NULL;
+    set_noallocate_mode(true);
+    if (exception_setup(true))
+        e = q_nth_element(l_meta.l, n);
+    exception_cancel();
+    set_noallocate_mode(false);
+
+    bool ok = true;
+    if (!e) {
+        if (l_meta.l && n >= 0 && n < lcnt) {
+            report(1, "ERROR: No element returned for index %d", n);
+            ok = false;
+        } else {
+            report(2, "Index %d is out of range", n);
+        }
+    } else {
+        element_t *nth = NULL;
+        ok = check_selection(n, false, &nth);
+        if (ok && nth != e) {
+            report(1, "ERROR: Returned element is not at index %d", n);
+            ok = false;
+        } else if (ok && argc == 3 && strcmp(e->value, argv[2])) {
+            report(1, "ERROR: Element %d is %s, expected %s", n, e->value,
+                   argv[2]);
+            ok = false;
+        } else {
+            report(2, "Element %d is %s", n, e->value);
+        }
+    }
+
+    show_queue(3);
+    return ok && !error_check();
+}
+
+static bool do_topk(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+
+    int k = 0;
+    if (!get_int(argv[1], &k)) {
+        report(1, "Invalid number of elements '%s'", argv[1]);
+        return false;
+    }
+
+    if (!l_meta.l)
+        report(3, "Warning: Calling topk on null queue");
+    error_check();
+
+    set_noallocate_mode(true);
+    if (exception_setup(true))
+        q_topk(l_meta.l, k);
+    exception_cancel();
+    set_noallocate_mode(false);
+
+    bool ok = true;
+    if (l_meta.l && lcnt && k > 0) {
+        element_t *kth = NULL;
+        ok = check_selection(k < lcnt ? k - 1 : lcnt - 1, true, &kth);
+    }
+
+    show_queue(3);
+    return ok && !error_check();
+}
+
+/* walk queue with an iterator, n elements at a time */
+static bool do_iter(int argc, char *argv[])
+{
+    if (argc != 1 && argc != 2) {
+        report(1, "%s needs 0-1 arguments", argv[0]);
+        return false;
+    }
+
+    int n = 1;
+    if (argc == 2 && (!get_int(argv[1], &n) || n < 1)) {
+        report(1, "Invalid batch size '%s'", argv[1]);
+        return false;
+    }
+
+    if (!l_meta.l)
+        report(3, "Warning: Calling iter on null queue");
+    error_check();
+
+    element_t **seen = malloc(sizeof(element_t *) * (lcnt + n));
+    if (!seen) {
+        report(1, "Could not allocate buffer for %lu elements", lcnt + n);
+        return false;
+    }
+
+    /*
+     * Collect the elements in queue order before applying any pending
+     * reversal, then compare them against the links.
+     */
+    bool ok = true;
+    size_t cnt = 0;
+    if (exception_setup(true)) {
+        queue_iter_t it;
+        q_iter_begin(l_meta.l, &it);
+        if (n == 1) {
+            element_t *e;
+            while (cnt <= lcnt && (e = q_iter_next(&it)))
+                seen[cnt++] = e;
+        } else {
+            size_t got;
+            while (cnt <= lcnt &&
+                   (got = q_iter_next_batch(&it, seen + cnt, n)))
+                cnt += got;
+        }
+        q_materialize(l_meta.l);
+    }
+    exception_cancel();
+
+    if (cnt != lcnt) {
+        report(1, "ERROR: Iterated over %lu elements, but queue has %lu", cnt,
+               lcnt);
+        ok = false;
+    } else if (l_meta.l) {
+        size_t i = 0;
+        element_t *item = NULL;
+        list_for_each_entry (item, l_meta.l, list) {
+            if (seen[i] != item) {
+                report(1, "ERROR: Element %lu of iterator is out of order", i);
+                ok = false;
+                break;
+            }
+            i++;
+        }
+    }
+    free(seen);
+
+    if (ok)
+        report(2, "Iterated over %lu elements", cnt);
+    return ok && !error_check();
+}
+
+/* move one iterator to each index in turn */
+static bool do_seek(int argc, char *argv[])
+{
+    if (argc < 2) {
+        report(1, "%s needs at least 1 argument", argv[0]);
+        return false;
+    }
+
+    int *indexes = malloc(sizeof(int) * argc);
+    element_t **found = calloc(argc, sizeof(element_t *));
+    bool ok = indexes && found;
+    for (int i = 1; ok && i < argc; i++) {
+        if (!get_int(argv[i], &indexes[i]) || indexes[i] < 0) {
+            report(1, "Invalid index '%s'", argv[i]);
+            ok = false;
+        }
+    }
+    if (!ok) {
+        free(indexes);
+        free(found);
+        return false;
+    }
+
+    if (!l_meta.l)
+        report(3, "Warning: Calling seek on null queue");
+    error_check();
+
+    /* Seeking from the position of the previous index reuses the iterator */
+    if (exception_setup(true)) {
+        queue_iter_t it;
+        q_iter_begin(l_meta.l, &it);
+        for (int i = 1; i < argc; i++)
+            found[i] = q_iter_seek(&it, indexes[i]) ? q_iter_next(&it) : NULL;
+        q_materialize(l_meta.l);
+    }
+    exception_cancel();
+
+    for (int i = 1; ok && i < argc; i++) {
+        element_t *expected = NULL;
+        if (l_meta.l && (size_t) indexes[i] < lcnt) {
+            struct list_head *cur = l_meta.l->next;
+            for (int j = 0; j < indexes[i]; j++)
+                cur = cur->next;
+            expected = list_entry(cur, element_t, list);
+        }
+
+        if (found[i] != expected) {
+            report(1, "ERROR: Seeking to index %d found the wrong element",
+                   indexes[i]);
+            ok = false;
+        } else if (expected) {
+            report(2, "Element %d is %s", indexes[i], expected->value);
+        } else {
+            report(2, "Index %d is out of range", indexes[i]);
+        }
+    }
+    free(indexes);
+    free(found);
+    return ok && !error_check();
+}
+
+static bool do_dm(int argc, char *argv[])
+{
+    if (simulation) {
+        if (argc != 1) {
+            report(1, "%s does not need arguments in simulation mode", argv[0]);
+            return false;
+        }
+        bool ok = is_delete_mid_const();
+        if (!ok) {
+            report(1, "ERROR: Probably not constant time");
+            return false;
+        }
+        report(1, "Probably constant time");
+        return ok;
+    }
+
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!l_meta.l)
+        report(3, "Warning: Try to access null queue");
+    error_check();
+
+    bool ok = true;
+    if (exception_setup(true))
+        ok = q_delete_mid(l_meta.l);
+    exception_cancel();
+
+    if (ok) {
+        lcnt--;
+        l_meta.size--;
+    }
+
+    show_queue(3);
+    return ok && !error_check();
+}
+
+static bool do_swap(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!l_meta.l)
+        report(3, "Warning: Try to access null queue");
+    error_check();
+
+    set_noallocate_mode(true);
+    if (exception_setup(true))
+        q_swap(l_meta.l);
+    exception_cancel();
+
+    set_noallocate_mode(false);
+
+    show_queue(3);
+    return !error_check();
+}
+
+static bool do_clone(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!l_meta.l)
+        report(3, "Warning: Calling clone on null queue");
+    error_check();
+
+    free_snapshot();
+    /* The clone is built in queue order, compare it against raw links below */
+    q_materialize(l_meta.l);
+    /* Count blocks once queues freed in the background are gone */
+    q_free_sync();
+    size_t bcnt = allocation_check();
+
+    struct list_head *snap = NULL;
+    if (exception_setup(true))
+        snap = q_clone(l_meta.l);
+    exception_cancel();
+
+    bool ok = true;
+    if (!snap) {
+        if (l_meta.l) {
+            fail_count++;
+            if (fail_count < fail_limit)
+                report(2, "Clone of queue failed");
+            else {
+                report(1, "ERROR: Clone of queue failed (%d failures total)",
+                       fail_count);
+                ok = false;
+            }
+        }
+        return ok && !error_check();
+    }
+
+    l_snap = snap;
+    snap_cnt = lcnt;
+
+    /*
+     * The clone must have its own links, but share every string.  Strings
+     * carved from an arena or taken from a recycle cache are bound to their
+     * element, so those may be copies.
+     */
+    struct list_head *cur = l_meta.l->next;
+    struct list_head *snap_cur = l_snap->next;
+    while (ok && cur != l_meta.l && snap_cur != l_snap) {
+        char *value = list_entry(cur, element_t, list)->value;
+        char *snap_value = list_entry(snap_cur, element_t, list)->value;
+        if (cur == snap_cur) {
+            report(1, "ERROR: Need to allocate separate element for clone");
+            ok = false;
+        } else if (l_meta.arena || l_meta.recycle
+                       ? strcmp(value, snap_value) != 0
+                       : value != snap_value) {
+            report(1, "ERROR: Clone should share strings with original queue");
+            ok = false;
+        }
+        cur = cur->next;
+        snap_cur = snap_cur->next;
+    }
+    if (ok && (cur != l_meta.l || snap_cur != l_snap)) {
+        report(1, "ERROR: Clone has different size than original queue");
+        ok = false;
+    }
+
+    report(2, "Cloned %d elements: %d strings shared, %lu blocks allocated",
+           (int) snap_cnt, q_shared(l_snap), allocation_check() - bcnt);
+    return ok && !error_check();
+}
+
+static bool do_restore(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!l_snap) {
+        report(1, "No snapshot to restore.  Use clone first");
+        return false;
+    }
+    error_check();
+
+    /*
+     * In deferred mode the original is freed while the clone is used, so
+     * both threads drop references to the strings they share
+     */
+    if (exception_setup(true))
+        q_free(l_meta.l);
+    exception_cancel();
+
+    l_meta.l = l_snap;
+    l_meta.size = snap_cnt;
+    l_meta.arena = false;
+    l_meta.recycle = false;
+    lcnt = snap_cnt;
+    l_snap = NULL;
+    snap_cnt = 0;
+
+    show_queue(3);
+    return !error_check();
+}
+
+static bool is_sorted(struct list_head *head)
+{
+    element_t *item = NULL, *prev = NULL;
+    list_for_each_entry (item, head, list) {
+        if (prev && strcmp(prev->value, item->value) > 0)
+            return false;
+        prev = item;
+    }
+    return true;
+}
+
+/* merge sorted snapshot into sorted queue */
+static bool do_merge(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!l_snap) {
+        report(1, "No snapshot to merge.  Use clone first");
+        return false;
+    }
+
+    if (!l_meta.l)
+        report(3, "Warning: Calling merge on null queue");
+    error_check();
+
+    if (l_meta.l) {
+        q_materialize(l_meta.l);
+        q_materialize(l_snap);
+        if (!is_sorted(l_meta.l) || !is_sorted(l_snap)) {
+            report(1, "Queue and snapshot must be sorted before merge");
+            return false;
+        }
+    }
+
+    set_noallocate_mode(true);
+    if (exception_setup(true))
+        q_merge_two(l_meta.l, l_snap);
+    exception_cancel();
+    set_noallocate_mode(false);
+
+    bool ok = true;
+    if (l_meta.l) {
+        if (q_size(l_snap)) {
+            report(1, "ERROR: Snapshot still holds %d elements after merge",
+                   q_size(l_snap));
+            ok = false;
+        } else {
+            lcnt += snap_cnt;
+            l_meta.size += snap_cnt;
+            snap_cnt = 0;
+            if (!is_sorted(l_meta.l)) {
+                report(1, "ERROR: Not sorted in ascending order");
+                ok = false;
+            }
+        }
+    }
+    free_snapshot();
+
+    show_queue(3);
     return ok && !error_check();
 }
 
-bool do_sort(int argc, char *argv[])
+/* sort and dedup typed queues of random integers and records */
+static bool do_typed(int argc, char *argv[])
 {
-    if (argc != 1) {
-        report(1, "%s takes no arguments", argv[0]);
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
         return false;
     }
 
-    if (!l_meta.l)
-        report(3, "Warning: Calling sort on null queue");
-    error_check();
+    int n = 0;
+    if (!get_int(argv[1], &n) || n < 1) {
+        report(1, "Invalid number of elements '%s'", argv[1]);
+        return false;
+    }
 
-    int cnt = q_size(l_meta.l);
-    if (cnt < 2)
-        report(3, "Warning: Calling sort on single node");
+    int *counts = calloc(n, sizeof(int));
+    if (!counts) {
+        report(1, "ERROR: Could not allocate counts");
+        return false;
+    }
+
+    /* The typed queues allocate through the harness, so they may fail too */
     error_check();
+    size_t bcnt = allocation_check();
+    struct list_head *ints = iq_new();
+    struct list_head *records = rq_new();
+    bool ok = ints && records;
+    for (int i = 0; ok && i < n; i++) {
+        int value = rand() % n;
+        record_t record = {.key = rand() % 16, .seq = i};
+        counts[value]++;
+        ok = (i & 1 ? iq_insert_tail(ints, value) : iq_insert_head(ints, value))
+             && rq_insert_tail(records, record);
+    }
+    int left = ok ? typed_distinct(ints) : -1;
+    if (left == -1) {
+        fail_count++;
+        ok = fail_count < fail_limit;
+        if (ok)
+            report(2, "Filling typed queues failed");
+        else
+            report(1, "ERROR: Could not fill typed queues (%d failures total)",
+                   fail_count);
+        goto out;
+    }
 
-    set_noallocate_mode(true);
-    if (exception_setup(true))
-        q_sort(l_meta.l);
-    exception_cancel();
-    set_noallocate_mode(false);
+    iq_sort(ints);
+    rq_sort(records);
+    iq_element_t *item = NULL, *prev = NULL;
+    list_for_each_entry (item, ints, list) {
+        if (prev && prev->value > item->value) {
+            report(1, "ERROR: Integers not sorted in ascending order");
+            ok = false;
+            break;
+        }
+        prev = item;
+    }
 
-    bool ok = true;
-    if (l_meta.size) {
-        for (struct list_head *cur_l = l_meta.l->next;
-             cur_l != l_meta.l && --cnt; cur_l = cur_l->next) {
-            /* Ensure each element in ascending order */
-            /* FIXME: add an option to specify sorting order */
-            element_t *item, *next_item;
-            item = list_entry(cur_l, element_t, list);
-            next_item = list_entry(cur_l->next, element_t, list);
-            if (strcasecmp(item->value, next_item->value) > 0) {
-                report(1, "ERROR: Not sorted in ascending order");
-                ok = false;
-                break;
-            }
+    /* Records with equal keys must keep their insertion order */
+    rq_element_t *rec = NULL, *prev_rec = NULL;
+    list_for_each_entry (rec, records, list) {
+        if (prev_rec &&
+            (prev_rec->value.key > rec->value.key ||
+             (prev_rec->value.key == rec->value.key &&
+              prev_rec->value.seq > rec->value.seq))) {
+            report(1, "ERROR: Records not sorted stably");
+            ok = false;
+            break;
         }
+        prev_rec = rec;
     }
 
-    show_queue(3);
+    int distinct = 0;
+    for (int v = 0; v < n; v++)
+        distinct += counts[v] > 0;
+    iq_delete_dup(ints);
+    prev = NULL;
+    list_for_each_entry (item, ints, list) {
+        if (prev && prev->value >= item->value) {
+            report(1, "ERROR: Duplicate integers left after dedup");
+            ok = false;
+            break;
+        }
+        prev = item;
+    }
+    if (ok && iq_size(ints) != distinct) {
+        report(1, "ERROR: Expected %d distinct integers, but %d are left",
+               distinct, iq_size(ints));
+        ok = false;
+    }
+    if (ok && left == -2) {
+        report(1, "ERROR: Longs not sorted or deduplicated");
+        ok = false;
+    } else if (ok && left != distinct) {
+        report(1, "ERROR: Expected %d distinct longs, but %d are left",
+               distinct, left);
+        ok = false;
+    }
+    if (ok)
+        report(2, "Sorted %d integers and records, %d integers are distinct",
+               n, distinct);
+
+out:
+    iq_free(ints);
+    rq_free(records);
+    free(counts);
+    size_t leaked = allocation_check() - bcnt;
+    if (leaked) {
+        report(1, "ERROR: Typed queues leaked %lu blocks", leaked);
+        ok = false;
+    }
     return ok && !error_check();
 }
 
-static bool do_dm(int argc, char *argv[])
+/* Threads of the threads command wait here until all queues are built */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    int built;
+    int threads;
+} stress_gate_t;
+
+/* One thread of the threads command */
+typedef struct {
+    int size;
+    struct list_head *q;
+    /* Queue of the next thread, which this thread frees */
+    struct list_head **next_q;
+    stress_gate_t *gate;
+    int failed;
+} stress_thread_t;
+
+static void stress_wait(stress_gate_t *gate)
 {
-    if (argc != 1) {
-        report(1, "%s takes no arguments", argv[0]);
+    pthread_mutex_lock(&gate->lock);
+    gate->built++;
+    pthread_cond_broadcast(&gate->done);
+    while (gate->built < gate->threads)
+        pthread_cond_wait(&gate->done, &gate->lock);
+    pthread_mutex_unlock(&gate->lock);
+}
+
+static void *stress_thread(void *arg)
+{
+    stress_thread_t *t = arg;
+    t->q = q_new();
+    for (int i = 0; t->q && i < t->size; i++) {
+        if (!q_insert_tail(t->q, "thread"))
+            t->failed++;
+        else if (i & 1)
+            q_release_element(q_remove_head(t->q, NULL, 0));
+    }
+
+    /* Free another thread's elements, while that thread frees someone else's */
+    stress_wait(t->gate);
+    q_free(*t->next_q);
+    return NULL;
+}
+
+static bool do_threads(int argc, char *argv[])
+{
+    if (argc != 3) {
+        report(1, "%s needs 2 arguments", argv[0]);
         return false;
     }
 
-    if (!l_meta.l)
-        report(3, "Warning: Try to access null queue");
+    int n = 0, size = 0;
+    if (!get_int(argv[1], &n) || n < 1) {
+        report(1, "Invalid number of threads '%s'", argv[1]);
+        return false;
+    }
+    if (!get_int(argv[2], &size) || size < 0) {
+        report(1, "Invalid number of elements '%s'", argv[2]);
+        return false;
+    }
+
+    stress_thread_t *threads = calloc(n, sizeof(stress_thread_t));
+    pthread_t *tids = calloc(n, sizeof(pthread_t));
+    if (!threads || !tids) {
+        report(1, "ERROR: Could not set up %d threads", n);
+        free(threads);
+        free(tids);
+        return false;
+    }
+    stress_gate_t gate = {.lock = PTHREAD_MUTEX_INITIALIZER,
+                          .done = PTHREAD_COND_INITIALIZER,
+                          .threads = n};
+
     error_check();
+    q_free_sync();
+    size_t before = allocation_check();
+
+    /* The time limit must hit this thread, not one of the workers */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int started = 0;
+    for (; started < n; started++) {
+        threads[started].size = size;
+        threads[started].next_q = &threads[(started + 1) % n].q;
+        threads[started].gate = &gate;
+        if (pthread_create(&tids[started], NULL, stress_thread,
+                           &threads[started]))
+            break;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
 
-    bool ok = true;
+    bool ok = started == n;
+    if (!ok) {
+        report(1, "ERROR: Could only start %d of %d threads", started, n);
+        /* Let the others go on, and free the queue nobody is left to free */
+        pthread_mutex_lock(&gate.lock);
+        gate.threads = started;
+        pthread_cond_broadcast(&gate.done);
+        pthread_mutex_unlock(&gate.lock);
+    }
+    int failed = 0;
+    for (int i = 0; i < started; i++) {
+        pthread_join(tids[i], NULL);
+        failed += threads[i].failed;
+    }
+    if (!ok)
+        q_free(threads[0].q);
+    q_free_sync();
+    free(threads);
+    free(tids);
+
+    size_t after = allocation_check();
+    if (after != before) {
+        report(1, "ERROR: %lu blocks were allocated, but %lu are",
+               before, after);
+        ok = false;
+    }
+    if (error_check())
+        ok = false;
+    if (ok)
+        report(2, "%d threads freed each other's queues, %d inserts failed",
+               n, failed);
+    return ok;
+}
+
+static bool do_failsite(int argc, char *argv[])
+{
+    if (argc > 2) {
+        report(1, "%s takes at most 1 argument", argv[0]);
+        return false;
+    }
+
+    set_fail_site(argc == 2 ? argv[1] : NULL);
+    return true;
+}
+
+static void oom_free(struct list_head *l)
+{
     if (exception_setup(true))
-        ok = q_delete_mid(l_meta.l);
+        q_free(l);
     exception_cancel();
+    q_free_sync();
+}
 
-    show_queue(3);
-    return ok && !error_check();
+/*
+ * Copy queue for the oom command, as a queue of the same kind as the one
+ * being tested if is_queue is set.  Return false if that failed
+ */
+static bool oom_copy(struct list_head *l,
+                     bool is_queue,
+                     struct list_head **copy)
+{
+    *copy = NULL;
+    if (!l)
+        return true;
+
+    bool ok = false;
+    if (exception_setup(true)) {
+        if (is_queue && l_meta.arena) {
+            *copy = q_new_arena();
+            ok = *copy;
+            element_t *item = NULL;
+            q_materialize(l);
+            list_for_each_entry (item, l, list) {
+                if (ok)
+                    ok = q_insert_tail(*copy, item->value);
+            }
+        } else {
+            *copy = q_clone(l);
+            ok = *copy;
+        }
+        if (ok && is_queue && l_meta.recycle)
+            ok = q_set_recycle(*copy, recycle_limit);
+    }
+    exception_cancel();
+    if (!ok && *copy) {
+        oom_free(*copy);
+        *copy = NULL;
+    }
+    return ok;
 }
 
-static bool do_swap(int argc, char *argv[])
+static bool oom_running = false;
+
+/*
+ * Run a command over and over, failing its first allocation, then its second
+ * one and so on, until a run completes without reaching the allocation to
+ * fail.  Every run starts from copies of queue and snapshot, and must neither
+ * report errors nor leak blocks.  The last run is the one that sticks.
+ */
+static bool do_oom(int argc, char *argv[])
 {
-    if (argc != 1) {
-        report(1, "%s takes no arguments", argv[0]);
+    if (argc < 2) {
+        report(1, "%s needs a command to run", argv[0]);
+        return false;
+    }
+    if (oom_running) {
+        report(1, "%s cannot run itself", argv[0]);
         return false;
     }
-
-    if (!l_meta.l)
-        report(3, "Warning: Try to access null queue");
     error_check();
 
-    set_noallocate_mode(true);
-    if (exception_setup(true))
-        q_swap(l_meta.l);
-    exception_cancel();
+    int saved_probability = fail_probability;
+    fail_probability = 0;
+    struct list_head *saved = NULL, *saved_snap = NULL;
+    if (!oom_copy(l_meta.l, true, &saved) ||
+        !oom_copy(l_snap, false, &saved_snap)) {
+        report(1, "ERROR: Could not copy queue to start runs from");
+        oom_free(saved);
+        fail_probability = saved_probability;
+        return false;
+    }
+    int saved_size = l_meta.size;
+    bool saved_arena = l_meta.arena, saved_recycle = l_meta.recycle;
+    size_t saved_lcnt = lcnt, saved_snap_cnt = snap_cnt;
+    oom_free(l_meta.l);
+    l_meta.l = NULL;
+    free_snapshot();
+    oom_blocks = allocation_check();
 
-    set_noallocate_mode(false);
+    int saved_fail_count = fail_count, saved_fail_limit = fail_limit;
+    /* Failures are expected here, and must not count as errors */
+    fail_limit = INT_MAX;
+    oom_running = true;
+
+    bool ok = true;
+    int n;
+    for (n = 1;; n++) {
+        size_t bcnt = allocation_check();
+        l_meta.arena = saved_arena;
+        l_meta.recycle = saved_recycle;
+        if (!oom_copy(saved, true, &l_meta.l) ||
+            !oom_copy(saved_snap, false, &l_snap)) {
+            report(1, "ERROR: Could not copy queue to start runs from");
+            ok = false;
+            break;
+        }
+        l_meta.size = saved_size;
+        lcnt = saved_lcnt;
+        snap_cnt = saved_snap_cnt;
+        fail_count = saved_fail_count;
+
+        set_fail_nth(n);
+        bool run_ok = interpret_cmda(argc - 1, argv + 1);
+        bool failed = fail_nth_done();
+        set_fail_nth(0);
+        if (!failed) {
+            ok = ok && run_ok;
+            break;
+        }
+
+        run_ok = !error_check() && run_ok;
+        oom_free(l_meta.l);
+        l_meta.l = NULL;
+        free_snapshot();
+        size_t leaked = allocation_check() - bcnt;
+        if (leaked) {
+            report(1, "ERROR: %lu blocks leaked", leaked);
+            run_ok = false;
+        }
+        if (!run_ok) {
+            report(1, "ERROR: %s went wrong when allocation %d failed",
+                   argv[1], n);
+            ok = false;
+        }
+    }
 
+    oom_running = false;
+    oom_blocks = 0;
+    fail_limit = saved_fail_limit;
+    fail_probability = saved_probability;
+    fail_nth = 0;
+    oom_free(saved);
+    oom_free(saved_snap);
+    if (ok)
+        report(2, "%s survived failure of each of its %d allocations",
+               argv[1], n - 1);
     show_queue(3);
-    return !error_check();
+    return ok;
 }
 
 static bool is_circular()
@@ -723,6 +2116,8 @@ static bool show_queue(int vlevel)
     struct list_head *cur = l_meta.l->next;
 
     if (exception_setup(true)) {
+        q_materialize(l_meta.l);
+        cur = l_meta.l->next;
         while (ok && ori != cur && cnt < lcnt) {
             element_t *e = list_entry(cur, element_t, list);
             if (cnt < big_list_size)
@@ -753,6 +2148,263 @@ static bool show_queue(int vlevel)
     return ok;
 }
 
+static bool do_recycle(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    recycle_stats_t stats;
+    if (!q_recycle_stats(l_meta.l, &stats)) {
+        report(1, "Queue does not recycle elements");
+        return !error_check();
+    }
+
+    size_t total = stats.hits + stats.misses;
+    report(1,
+           "Recycle cache: %lu hits, %lu misses (%.1f%% hit rate), %lu "
+           "cached",
+           stats.hits, stats.misses, total ? 100.0 * stats.hits / total : 0.0,
+           stats.cached);
+    return !error_check();
+}
+
+static int cmp_site_bytes(const void *a, const void *b)
+{
+    const alloc_site_t *sa = *(alloc_site_t *const *) a;
+    const alloc_site_t *sb = *(alloc_site_t *const *) b;
+    return (sa->bytes < sb->bytes) - (sa->bytes > sb->bytes);
+}
+
+static bool do_allocs(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    size_t n = 0;
+    for (alloc_site_t *site = allocation_sites(); site; site = site->next)
+        n++;
+    if (!n) {
+        report(1, "No blocks allocated yet");
+        return true;
+    }
+
+    alloc_site_t **order = malloc(sizeof(alloc_site_t *) * n);
+    if (!order) {
+        report(1, "Could not allocate buffer for %lu sites", n);
+        return false;
+    }
+    n = 0;
+    for (alloc_site_t *site = allocation_sites(); site; site = site->next)
+        order[n++] = site;
+    qsort(order, n, sizeof(alloc_site_t *), cmp_site_bytes);
+
+    report(1, "%-36s %9s %9s %11s %11s %11s", "Site", "Allocs", "Frees",
+           "Bytes", "Peak bytes", "Lifetime us");
+    for (size_t i = 0; i < n; i++) {
+        const alloc_site_t *site = order[i];
+        char name[64];
+        if (site->file)
+            snprintf(name, sizeof(name), "%s:%d %s", site->file, site->line,
+                     site->func);
+        else
+            snprintf(name, sizeof(name), "%s", site->func);
+        double lifetime =
+            site->timed_frees ? 1e6 * site->lifetime / site->timed_frees : 0.0;
+        report(1, "%-36s %9lu %9lu %11lu %11lu %11.1f", name, site->allocs,
+               site->frees, site->bytes, site->peak_bytes, lifetime);
+    }
+
+    bool header = false;
+    for (size_t i = 0; i < n; i++) {
+        const alloc_site_t *site = order[i];
+        if (!site->reallocs)
+            continue;
+        if (!header)
+            report(1, "%-36s %9s %9s %11s", "Realloc site", "Reallocs",
+                   "In place", "Bytes copied");
+        header = true;
+        char name[64];
+        if (site->file)
+            snprintf(name, sizeof(name), "%s:%d %s", site->file, site->line,
+                     site->func);
+        else
+            snprintf(name, sizeof(name), "%s", site->func);
+        report(1, "%-36s %9lu %9lu %11lu", name, site->reallocs,
+               site->reallocs - site->moves, site->copied_bytes);
+    }
+    free(order);
+    return true;
+}
+
+/*
+ * Grow a buffer to n bytes one byte at a time with test_realloc, then shrink
+ * it by halves, checking that its contents survive each step.
+ */
+static bool do_grow(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+
+    int n = 0;
+    if (!get_int(argv[1], &n) || n < 1) {
+        report(1, "Invalid number of bytes '%s'", argv[1]);
+        return false;
+    }
+
+    static alloc_site_t grow_site = {
+        .file = __FILE__, .line = __LINE__, .func = "do_grow"};
+    size_t reallocs = grow_site.reallocs, moves = grow_site.moves;
+    error_check();
+
+    bool ok = true;
+    unsigned char *buf = NULL;
+    int size = 0;
+    if (exception_setup(true)) {
+        while (ok && size < n) {
+            unsigned char *grown = test_realloc_at(buf, size + 1, &grow_site);
+            if (!grown)
+                break;
+            buf = grown;
+            ok = !size || buf[size - 1] == (unsigned char) (size - 1);
+            buf[size] = size;
+            size++;
+        }
+        for (int i = 0; ok && i < size; i++)
+            ok = buf[i] == (unsigned char) i;
+        while (ok && size > 1) {
+            unsigned char *shrunk = test_realloc_at(buf, size / 2, &grow_site);
+            if (!shrunk)
+                break;
+            buf = shrunk;
+            size /= 2;
+            for (int i = 0; ok && i < size; i++)
+                ok = buf[i] == (unsigned char) i;
+        }
+    }
+    exception_cancel();
+    test_free(buf);
+
+    if (!ok) {
+        report(1, "ERROR: Contents of buffer changed when resized");
+        return false;
+    }
+    reallocs = grow_site.reallocs - reallocs;
+    moves = grow_site.moves - moves;
+    report(2, "%lu reallocs, %lu of them in place", reallocs,
+           reallocs - moves);
+    return !error_check();
+}
+
+static bool do_calibrate(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    double scale = calibrate_time_limit();
+    report(2, "Time limits scaled by %.2f to the speed of this machine",
+           scale);
+    return true;
+}
+
+static bool do_mem(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    mem_stats_t stats;
+    memory_stats(&stats);
+    report(1, "Queue blocks: %lu live (peak %lu), %lu bytes (peak %lu)",
+           stats.blocks, stats.peak_blocks, stats.bytes, stats.peak_bytes);
+    size_t elements = lcnt + snap_cnt;
+    if (elements)
+        report(1, "Bytes per element: %.1f over %lu elements",
+               (double) stats.bytes / elements, elements);
+    report(1,
+           "Overhead: %lu bytes of headers and guards, %lu bytes of malloc "
+           "slack, %lu bytes in quarantine",
+           stats.overhead, stats.slack, stats.quarantined);
+
+    size_t blocks, bytes, peak;
+    memory_usage(&blocks, &bytes, &peak);
+    report(1, "Console blocks: %lu live, %lu bytes (peak %lu)", blocks, bytes,
+           peak);
+
+    if (!stats.blocks)
+        return true;
+    report(1, "Size classes:");
+    for (int c = 0; c < SIZE_CLASSES; c++) {
+        if (!stats.size_classes[c])
+            continue;
+        if (c < SIZE_CLASSES - 1)
+            report(1, "\t<= %-8lu %10lu blocks", (size_t) 8 << c,
+                   stats.size_classes[c]);
+        else
+            report(1, "\t>  %-8lu %10lu blocks", (size_t) 8 << (c - 1),
+                   stats.size_classes[c]);
+    }
+    return true;
+}
+
+/* Write histograms as CSV, one line per bucket */
+static bool write_histograms(const alloc_histograms_t *h, const char *name)
+{
+    FILE *file = fopen(name, "w");
+    if (!file) {
+        report(1, "Could not open '%s' for writing", name);
+        return false;
+    }
+    fprintf(file, "low,high,sizes,lifetime_ns,lifetime_ops\n");
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        size_t low = i ? (size_t) 1 << (i - 1) : 0;
+        fprintf(file, "%lu,", low);
+        if (i < HISTOGRAM_BUCKETS - 1)
+            fprintf(file, "%lu", i ? 2 * low - 1 : 0);
+        fprintf(file, ",%lu,%lu,%lu\n", h->sizes[i], h->lifetime_ns[i],
+                h->lifetime_ops[i]);
+    }
+    return !fclose(file);
+}
+
+static bool do_hist(int argc, char *argv[])
+{
+    if (argc > 2) {
+        report(1, "%s takes at most 1 argument", argv[0]);
+        return false;
+    }
+
+    alloc_histograms_t h;
+    allocation_histograms(&h);
+    if (argc == 2)
+        return write_histograms(&h, argv[1]);
+
+    report(1, "%-24s %10s %12s %12s", "Range", "Sizes", "Lifetime ns",
+           "Lifetime ops");
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        if (!h.sizes[i] && !h.lifetime_ns[i] && !h.lifetime_ops[i])
+            continue;
+        char range[32];
+        size_t low = i ? (size_t) 1 << (i - 1) : 0;
+        if (i == HISTOGRAM_BUCKETS - 1)
+            snprintf(range, sizeof(range), "%lu+", low);
+        else
+            snprintf(range, sizeof(range), "%lu-%lu", low,
+                     i ? 2 * low - 1 : 0);
+        report(1, "%-24s %10lu %12lu %12lu", range, h.sizes[i],
+               h.lifetime_ns[i], h.lifetime_ops[i]);
+    }
+    return true;
+}
+
 static bool do_show(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -782,6 +2434,18 @@ static void console_init()
         rt,
         " [str]          | Remove from tail of queue.  Optionally compare "
         "to expected value str");
+    ADD_COMMAND(iho,
+                " str [n]        | Insert string str at head of queue n times, "
+                "handing over ownership");
+    ADD_COMMAND(ito,
+                " str [n]        | Insert string str at tail of queue n times, "
+                "handing over ownership");
+    ADD_COMMAND(rhv,
+                " [str]          | Remove from head of queue without copying.  "
+                "Optionally compare to expected value str");
+    ADD_COMMAND(rtv,
+                " [str]          | Remove from tail of queue without copying.  "
+                "Optionally compare to expected value str");
     ADD_COMMAND(
         rhq,
         "                | Remove from head of queue without reporting value.");
@@ -795,10 +2459,102 @@ static void console_init()
         dedup, "                | Delete all nodes that have duplicate string");
     ADD_COMMAND(swap,
                 "                | Swap every two adjacent nodes in queue");
+    ADD_COMMAND(
+        pqpush,
+        " str [n]        | Push string str into priority queue n times. "
+        "Generate random string(s) if str equals RAND. (default: n == 1)");
+    ADD_COMMAND(
+        pqpop,
+        " [str]          | Remove smallest element of priority queue.  "
+        "Optionally compare to expected value str");
+    ADD_COMMAND(pqdrain,
+                "                | Remove all elements of priority queue in "
+                "ascending order");
+    ADD_COMMAND(pqmeld,
+                "                | Meld snapshot taken by clone into priority "
+                "queue");
+    ADD_COMMAND(nth,
+                " n [str]        | Move element n to its sorted position.  "
+                "Optionally compare to expected value str");
+    ADD_COMMAND(topk,
+                " k              | Move k smallest elements to front in "
+                "ascending order");
+    ADD_COMMAND(iter,
+                " [n]            | Walk queue with an iterator, n elements at "
+                "a time (default: n == 1)");
+    ADD_COMMAND(seek,
+                " i [j ...]      | Move an iterator to index i, then to index "
+                "j and so on");
+    ADD_COMMAND(clone,
+                "                | Take snapshot of queue sharing its strings");
+    ADD_COMMAND(restore,
+                "                | Replace queue with snapshot taken by clone");
+    ADD_COMMAND(merge,
+                "                | Merge sorted snapshot taken by clone into "
+                "sorted queue");
+    ADD_COMMAND(allocs,
+                "                | Show allocations of queue code by call "
+                "site");
+    ADD_COMMAND(grow,
+                " n              | Grow buffer to n bytes with realloc and "
+                "shrink it again");
+    ADD_COMMAND(recycle,
+                "                | Show hit rate of the recycle cache of queue");
+    ADD_COMMAND(typed,
+                " n              | Sort and dedup typed queues of n random "
+                "integers and records");
+    ADD_COMMAND(failsite,
+                " [site]         | Fail every allocation of function or "
+                "file:line site");
+    ADD_COMMAND(oom,
+                " cmd [args...]  | Rerun cmd failing each allocation in turn");
+    ADD_COMMAND(mem,
+                "                | Display memory used by queues and "
+                "harness");
+    ADD_COMMAND(hist,
+                " [file]         | Display histograms of block sizes and "
+                "lifetimes, or write them to file as CSV");
+    ADD_COMMAND(calibrate,
+                "                | Scale time limits to the speed of this "
+                "machine");
+    ADD_COMMAND(threads,
+                " n m            | Let n threads insert m elements into queues "
+                "and free each other's");
     add_param("length", &string_length, "Maximum length of displayed string",
               NULL);
+    add_param("arena", &arena_mode,
+              "Carve elements of new queues from an arena (0/1)", NULL);
+    add_param("deferfree", &deferred_free,
+              "Free queues on a reclamation thread (0/1)", set_deferred_free);
+    add_param("recycle", &recycle_limit,
+              "Number of released elements the queue caches for reuse",
+              set_recycle);
+    add_param("guard", &guard_mode,
+              "Place blocks in front of guard pages to trap overflows (0/1)",
+              set_guard);
+    add_param("nofill", &nofill_size,
+              "Skip filling blocks of at least this many bytes (0 fills all)",
+              set_nofill);
+    add_param("quarantine", &quarantine_budget,
+              "Bytes of freed blocks checked for writes after free",
+              set_quarantine_budget);
+    add_param("profile", &profile_mode,
+              "Time blocks for the lifetimes shown by allocs (0/1)",
+              set_profile);
+    add_param("histogram", &histogram_mode,
+              "Collect histograms of block sizes and lifetimes (0/1)",
+              set_histogram);
+    add_param("backtrace", &backtrace_depth,
+              "Frames of backtrace recorded per allocation for leak reports",
+              set_backtrace);
+    add_param("timelimit", &time_limit_ms,
+              "Time limit of commands without a budget in ms (0 for none)",
+              set_timelimit);
     add_param("malloc", &fail_probability, "Malloc failure probability percent",
               NULL);
+    add_param("seed", &fail_seed, "Seed of the malloc failures", set_seed);
+    add_param("failnth", &fail_nth,
+              "Fail the nth allocation from now on (0 fails none)", set_nth);
     add_param("fail", &fail_limit,
               "Number of times allow queue operations to return false", NULL);
 }
@@ -809,6 +2565,9 @@ static void sigsegvhandler(int sig)
     report(1,
            "Segmentation fault occurred.  You dereferenced a NULL or invalid "
            "pointer");
+    if (guard_mode)
+        report(1,
+               "Guard mode is on: the access may be past the end of a block");
     /* Raising a SIGABRT signal to produce a core dump for debugging. */
     abort();
 }
@@ -831,18 +2590,18 @@ static void queue_init()
 static bool queue_quit(int argc, char *argv[])
 {
     report(3, "Freeing queue");
-    if (lcnt > big_list_size)
-        set_cautious_mode(false);
+    free_snapshot();
 
     if (exception_setup(true))
         q_free(l_meta.l);
     exception_cancel();
-    set_cautious_mode(true);
+    q_free_sync();
 
     size_t bcnt = allocation_check();
     if (bcnt > 0) {
         report(1, "ERROR: Freed queue, but %lu blocks are still allocated",
                bcnt);
+        report_leaks(LEAK_ORIGINS);
         return false;
     }
 
@@ -940,6 +2699,8 @@ int main(int argc, char *argv[])
     }
 
     srand((unsigned int) (time(NULL)));
+    fail_seed = (int) (time(NULL) & INT_MAX);
+    set_fail_seed(fail_seed);
     queue_init();
     init_cmd();
     console_init();
@@ -957,6 +2718,9 @@ int main(int argc, char *argv[])
         set_logfile(logfile_name);
 
     add_quit_helper(queue_quit);
+    set_cmd_hooks(before_command, after_command);
+    no_time_limit = getenv("QTEST_NO_TIMELIMIT") != NULL;
+    apply_time_limit(time_limit_ms);
 
     bool ok = true;
     ok = ok && run_console(infile_name);
@@ -1,3 +1,7 @@
+#include <endian.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,353 +15,1811 @@
  *   cppcheck-suppress nullPointer
  */
 
+/*
+ * Every string stored in the queue is preceded by a reference count, so that
+ * q_clone() can share the payload between queues instead of copying it.
+ * Strings are never written after insertion, which keeps shared strings
+ * intact.
+ * Two counts mark a string bound to the element it was allocated with, which
+ * is neither shared nor freed on its own: STR_ARENA for one carved from an
+ * arena, and STR_POOLED for the buffer of a recycled element.
+ * Counts are changed atomically, since the reclamation thread drops the
+ * references of a freed queue while its clones may still share the strings.
+ */
+typedef struct {
+    size_t refcnt;
+    char data[];
+} shared_str_t;
+
+#define STR_ARENA 0
+#define STR_POOLED ((size_t) -1)
+
+static inline shared_str_t *str_header(const char *value)
+{
+    return (shared_str_t *) (value - offsetof(shared_str_t, data));
+}
+
+static char *str_new(size_t length)
+{
+    shared_str_t *str = malloc(sizeof(shared_str_t) + length);
+    if (!str) {
+        return NULL;
+    }
+
+    str->refcnt = 1;
+    return str->data;
+}
+
+static inline size_t str_refs(const char *value)
+{
+    return __atomic_load_n(&str_header(value)->refcnt, __ATOMIC_RELAXED);
+}
+
+static inline bool str_bound(const char *value)
+{
+    size_t refcnt = str_refs(value);
+    return refcnt == STR_ARENA || refcnt == STR_POOLED;
+}
+
+static inline char *str_get(char *value)
+{
+    __atomic_add_fetch(&str_header(value)->refcnt, 1, __ATOMIC_RELAXED);
+    return value;
+}
+
+/*
+ * Share value of length len with another element, or copy it if it is bound
+ * to its own.
+ * Return NULL if could not allocate space.
+ */
+static char *str_share(char *value, size_t len)
+{
+    if (!str_bound(value)) {
+        return str_get(value);
+    }
+
+    char *copy = str_new(len + 1);
+    if (copy) {
+        memcpy(copy, value, len + 1);
+    }
+    return copy;
+}
+
+static void str_put(char *value)
+{
+    shared_str_t *str = str_header(value);
+    if (!__atomic_sub_fetch(&str->refcnt, 1, __ATOMIC_ACQ_REL)) {
+        free(str);
+    }
+}
+
+/*
+ * Record the length of the string of e, once it is in place.  The packed
+ * layout also keeps a copy of its first characters in the element.
+ */
+static inline void set_len(element_t *e, size_t len)
+{
+    e->len = len;
+#ifdef QUEUE_PACKED
+    size_t n = len < QUEUE_PREFIX_LEN ? len : QUEUE_PREFIX_LEN;
+    memcpy(e->prefix, e->value, n);
+    memset(e->prefix + n, 0, QUEUE_PREFIX_LEN - n);
+#endif
+}
+
+/* Block of memory that arena-backed queues carve their elements from */
+struct arena_chunk {
+    struct arena_chunk *next;
+    char data[];
+};
+
+#define ARENA_MIN_CHUNK 4096
+#define ARENA_MAX_CHUNK (1 << 20)
+
+/* Capacities of recycled string buffers: 16, 32, ..., 2048 bytes */
+#define RECYCLE_MIN_STRING 16
+#define RECYCLE_CLASSES 8
+
+/*
+ * Cache of released elements of a recycling queue, see q_set_recycle().
+ * Each element is allocated together with a string buffer of the capacity of
+ * its size class, and goes back to the free list of that class when released,
+ * as long as fewer than limit elements are cached.  The pool outlives its
+ * queue for as long as elements allocated from it do.
+ */
+struct recycle_pool {
+    /* Free lists linked through list.next */
+    struct list_head *free[RECYCLE_CLASSES];
+    size_t cached;
+    size_t limit;
+    size_t hits;
+    size_t misses;
+    /*
+     * Elements allocated and not yet freed, plus one while the queue lives.
+     * Updated atomically, since the reclamation thread frees elements too.
+     */
+    size_t refs;
+    bool live;
+};
+
+/* Element of a recycling queue, followed by the header of its string */
+typedef struct {
+    struct recycle_pool *pool;
+    size_t cls;
+    element_t elem;
+} pooled_t;
+
+/*
+ * Queue header.  Callers only see the embedded list head, so it must stay the
+ * first member.
+ */
+typedef struct queue {
+    struct list_head head;
+    /* Queue order is the reverse of link order, see q_reverse() */
+    bool reversed;
+    size_t size;
+    /* Node at index size / 2 in queue order, or head if queue is empty */
+    struct list_head *mid;
+    /*
+     * Root of the pairing heap used by the q_pq_* operations.  Elements live
+     * either in the list or in the heap, never in both at once.
+     */
+    struct list_head *heap;
+    size_t heap_size;
+    /*
+     * Chunks owned by the queue, newest first, and the free space left in the
+     * newest one.  Elements of an arena-backed queue are carved from them.
+     */
+    struct arena_chunk *chunks;
+    char *arena_next;
+    size_t arena_left;
+    size_t arena_cap;
+    bool arena;
+    /* Some elements may have been allocated on their own */
+    bool loose;
+    /* Next queue waiting for the reclamation thread, see q_free() */
+    struct queue *reclaim_next;
+    /* Cache of released elements, or NULL if the queue does not recycle */
+    struct recycle_pool *pool;
+} queue_t;
+
+static inline queue_t *to_queue(struct list_head *head)
+{
+    return list_entry(head, queue_t, head);
+}
+
+static void pq_flush(queue_t *q);
+
+/* Like to_queue(), but moves priority queue elements back to the list first */
+static inline queue_t *to_list_queue(struct list_head *head)
+{
+    queue_t *q = to_queue(head);
+    if (q->heap) {
+        pq_flush(q);
+    }
+    return q;
+}
+
+/* Next node in queue order */
+static inline struct list_head *q_next(const queue_t *q,
+                                       const struct list_head *node)
+{
+    return q->reversed ? node->prev : node->next;
+}
+
+/* Previous node in queue order */
+static inline struct list_head *q_prev(const queue_t *q,
+                                       const struct list_head *node)
+{
+    return q->reversed ? node->next : node->prev;
+}
+
+/* Link node as the first element in queue order */
+static void q_link_head(queue_t *q, struct list_head *node)
+{
+    if (q->reversed) {
+        list_add_tail(node, &q->head);
+    } else {
+        list_add(node, &q->head);
+    }
+
+    /* Every index moves up by one; the middle index only does if size is odd */
+    if (!q->size) {
+        q->mid = node;
+    } else if (!(q->size & 1)) {
+        q->mid = q_prev(q, q->mid);
+    }
+    q->size++;
+}
+
+/* Link node as the last element in queue order */
+static void q_link_tail(queue_t *q, struct list_head *node)
+{
+    if (q->reversed) {
+        list_add(node, &q->head);
+    } else {
+        list_add_tail(node, &q->head);
+    }
+
+    if (!q->size) {
+        q->mid = node;
+    } else if (q->size & 1) {
+        q->mid = q_next(q, q->mid);
+    }
+    q->size++;
+}
+
+/*
+ * Unlink node from queue.  Side tells whether node lies before (< 0) or after
+ * (> 0) the middle node in queue order.
+ */
+static void q_unlink(queue_t *q, struct list_head *node, int side)
+{
+    if (node == q->mid) {
+        side = 0;
+    }
+
+    if (q->size & 1) {
+        if (side <= 0) {
+            q->mid = q_next(q, q->mid);
+        }
+    } else if (side >= 0) {
+        q->mid = q_prev(q, q->mid);
+    }
+
+    list_del(node);
+    q->size--;
+}
+
+/* Locate the middle node again after the queue was rearranged */
+static void q_reset_mid(queue_t *q)
+{
+    q->mid = q_next(q, &q->head);
+    for (size_t i = 0; i < q->size / 2; i++) {
+        q->mid = q_next(q, q->mid);
+    }
+}
+
+/*
+ * Carve size bytes from the arena of q, starting a chunk twice as large as
+ * the previous one when the newest chunk is full.
+ * Return NULL if could not allocate space.
+ */
+static void *arena_alloc(queue_t *q, size_t size)
+{
+    size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    if (size > q->arena_left) {
+        size_t cap = q->arena_cap ? q->arena_cap * 2 : ARENA_MIN_CHUNK;
+        if (cap > ARENA_MAX_CHUNK) {
+            cap = ARENA_MAX_CHUNK;
+        }
+        if (cap < size) {
+            cap = size;
+        }
+
+        struct arena_chunk *chunk = malloc(sizeof(struct arena_chunk) + cap);
+        if (!chunk) {
+            return NULL;
+        }
+
+        chunk->next = q->chunks;
+        q->chunks = chunk;
+        q->arena_next = chunk->data;
+        q->arena_left = cap;
+        q->arena_cap = cap;
+    }
+
+    void *p = q->arena_next;
+    q->arena_next += size;
+    q->arena_left -= size;
+    return p;
+}
+
+/*
+ * Hand the chunks of other over to q, so that elements moved from other stay
+ * valid for as long as q does.  The newest chunk of q keeps serving inserts.
+ */
+static void arena_adopt(queue_t *q, queue_t *other)
+{
+    if (other->loose) {
+        q->loose = true;
+    }
+    if (!other->chunks) {
+        return;
+    }
+
+    struct arena_chunk *last = other->chunks;
+    while (last->next) {
+        last = last->next;
+    }
+
+    if (q->chunks) {
+        last->next = q->chunks->next;
+        q->chunks->next = other->chunks;
+    } else {
+        last->next = NULL;
+        q->chunks = other->chunks;
+    }
+    other->chunks = NULL;
+    other->arena_next = NULL;
+    other->arena_left = 0;
+}
+
+/* Free every chunk of q, together with the elements carved from them */
+static void arena_release(queue_t *q)
+{
+    while (q->chunks) {
+        struct arena_chunk *next = q->chunks->next;
+        free(q->chunks);
+        q->chunks = next;
+    }
+}
+
+static void pool_unref(struct recycle_pool *pool)
+{
+    if (!__atomic_sub_fetch(&pool->refs, 1, __ATOMIC_ACQ_REL)) {
+        free(pool);
+    }
+}
+
+/* Free cached elements of pool until at most limit are left */
+static void pool_trim(struct recycle_pool *pool, size_t limit)
+{
+    for (size_t cls = 0; cls < RECYCLE_CLASSES && pool->cached > limit;
+         cls++) {
+        while (pool->free[cls] && pool->cached > limit) {
+            element_t *e = list_entry(pool->free[cls], element_t, list);
+            pool->free[cls] = e->list.next;
+            pool->cached--;
+            free(container_of(e, pooled_t, elem));
+            pool_unref(pool);
+        }
+    }
+}
+
+/*
+ * Stop q from recycling.  Elements still allocated from its pool are freed
+ * when released, and the last of them frees the pool.
+ */
+static void pool_detach(queue_t *q)
+{
+    struct recycle_pool *pool = q->pool;
+    if (!pool) {
+        return;
+    }
+
+    q->pool = NULL;
+    pool->live = false;
+    pool_trim(pool, 0);
+    pool_unref(pool);
+}
+
+/*
+ * Take an element for string s of length len from the free list of size
+ * class cls, or allocate a new one.
+ * Return NULL if could not allocate space.
+ */
+static element_t *pool_element(struct recycle_pool *pool,
+                               size_t cls,
+                               const char *s,
+                               size_t len)
+{
+    pooled_t *p;
+    if (pool->free[cls]) {
+        element_t *e = list_entry(pool->free[cls], element_t, list);
+        pool->free[cls] = e->list.next;
+        pool->cached--;
+        pool->hits++;
+        p = container_of(e, pooled_t, elem);
+    } else {
+        p = malloc(sizeof(pooled_t) + sizeof(shared_str_t) +
+                   (RECYCLE_MIN_STRING << cls));
+        if (!p) {
+            return NULL;
+        }
+
+        shared_str_t *str = (shared_str_t *) (p + 1);
+        str->refcnt = STR_POOLED;
+        p->pool = pool;
+        p->cls = cls;
+        p->elem.value = str->data;
+        __atomic_add_fetch(&pool->refs, 1, __ATOMIC_RELAXED);
+        pool->misses++;
+    }
+
+    memcpy(p->elem.value, s, len + 1);
+    set_len(&p->elem, len);
+    return &p->elem;
+}
+
+/*
+ * Free element e and its string, unless they go away with an arena.  Unless
+ * recycle is false, an element of a recycling queue is cached instead if its
+ * pool has room.  The reclamation thread passes false, as it must not touch
+ * the free lists.
+ */
+static void element_free(element_t *e, bool recycle)
+{
+    size_t refcnt = str_refs(e->value);
+    if (refcnt == STR_ARENA) {
+        return;
+    }
+    if (refcnt != STR_POOLED) {
+        str_put(e->value);
+        free(e);
+        return;
+    }
+
+    pooled_t *p = container_of(e, pooled_t, elem);
+    struct recycle_pool *pool = p->pool;
+    if (recycle && pool->live && pool->cached < pool->limit) {
+        e->list.next = pool->free[p->cls];
+        pool->free[p->cls] = &e->list;
+        pool->cached++;
+        return;
+    }
+
+    free(p);
+    pool_unref(pool);
+}
+
+static struct list_head *queue_new(bool arena)
+{
+    queue_t *q = malloc(sizeof(queue_t));
+    if (!q) {
+        return NULL;
+    }
+
+    INIT_LIST_HEAD(&q->head);
+    q->reversed = false;
+    q->size = 0;
+    q->mid = &q->head;
+    q->heap = NULL;
+    q->heap_size = 0;
+    q->chunks = NULL;
+    q->arena_next = NULL;
+    q->arena_left = 0;
+    q->arena_cap = 0;
+    q->arena = arena;
+    q->loose = !arena;
+    q->reclaim_next = NULL;
+    q->pool = NULL;
+    return &q->head;
+}
+
 /*
  * Create empty queue.
  * Return NULL if could not allocate space.
  */
 struct list_head *q_new()
 {
-    struct list_head *head = malloc(sizeof(struct list_head));
+    return queue_new(false);
+}
+
+/*
+ * Create empty queue whose elements are carved from large blocks it owns.
+ * Return NULL if could not allocate space.
+ */
+struct list_head *q_new_arena()
+{
+    return queue_new(true);
+}
+
+/* Free all storage used by queue, right away */
+static void queue_destroy(struct list_head *l)
+{
+    /* Elements of an arena-backed queue go away with its chunks */
+    queue_t *q = to_queue(l);
+    if (!q->loose) {
+        arena_release(q);
+        free(q);
+        return;
+    }
+
+    element_t *entry = NULL;
+    element_t *safe = NULL;
+    list_for_each_entry_safe (entry, safe, l, list) {
+        list_del(&entry->list);
+        element_free(entry, false);
+    }
+
+    /* Unwind the heap, using the sibling links as a stack of pending nodes */
+    struct list_head *stack = to_queue(l)->heap;
+    while (stack) {
+        struct list_head *node = stack;
+        stack = node->next;
+        struct list_head *child = node->prev;
+        while (child) {
+            struct list_head *next = child->next;
+            child->next = stack;
+            stack = child;
+            child = next;
+        }
+        element_free(list_entry(node, element_t, list), false);
+    }
+    arena_release(q);
+    free(q);
+}
+
+/*
+ * Deferred freeing.  q_free() pushes the queue onto a stack of pending queues
+ * in O(1) time, and the reclamation thread takes the whole stack as one batch
+ * whenever it wakes up.
+ */
+static bool deferred_free = false;
+static bool reclaimer_started = false;
+static bool reclaim_busy = false;
+static queue_t *reclaim_pending = NULL;
+static pthread_mutex_t reclaim_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t reclaim_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t reclaim_idle = PTHREAD_COND_INITIALIZER;
+
+static void *reclaim_thread(void *arg)
+{
+    pthread_mutex_lock(&reclaim_lock);
+    for (;;) {
+        while (!reclaim_pending) {
+            pthread_cond_wait(&reclaim_work, &reclaim_lock);
+        }
+
+        queue_t *batch = reclaim_pending;
+        reclaim_pending = NULL;
+        reclaim_busy = true;
+        pthread_mutex_unlock(&reclaim_lock);
+
+        while (batch) {
+            queue_t *next = batch->reclaim_next;
+            queue_destroy(&batch->head);
+            batch = next;
+        }
+
+        pthread_mutex_lock(&reclaim_lock);
+        reclaim_busy = false;
+        if (!reclaim_pending) {
+            pthread_cond_broadcast(&reclaim_idle);
+        }
+    }
+    return NULL;
+}
+
+/* Start the reclamation thread unless it runs already.  Call with the lock */
+static bool reclaim_start()
+{
+    if (reclaimer_started) {
+        return true;
+    }
+
+    /* Signals, such as the time limit of qtest, must reach the caller */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    pthread_t tid;
+    reclaimer_started = !pthread_create(&tid, NULL, reclaim_thread, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (reclaimer_started) {
+        pthread_detach(tid);
+    }
+    return reclaimer_started;
+}
+
+/*
+ * Free all storage used by queue.
+ * In deferred mode the queue is handed to the reclamation thread instead,
+ * unless it is an arena-backed queue that can be freed in O(1) time anyway.
+ */
+void q_free(struct list_head *l)
+{
+    if (!l) {
+        return;
+    }
+
+    queue_t *q = to_queue(l);
+    pool_detach(q);
+    if (deferred_free && q->loose) {
+        pthread_mutex_lock(&reclaim_lock);
+        bool started = reclaim_start();
+        if (started) {
+            q->reclaim_next = reclaim_pending;
+            reclaim_pending = q;
+            pthread_cond_signal(&reclaim_work);
+        }
+        pthread_mutex_unlock(&reclaim_lock);
+        if (started) {
+            return;
+        }
+    }
+
+    queue_destroy(l);
+}
+
+void q_set_deferred_free(bool deferred)
+{
+    deferred_free = deferred;
+}
+
+/* Wait until the reclamation thread has freed every queue handed to it */
+void q_free_sync()
+{
+    pthread_mutex_lock(&reclaim_lock);
+    while (reclaim_pending || reclaim_busy) {
+        pthread_cond_wait(&reclaim_idle, &reclaim_lock);
+    }
+    pthread_mutex_unlock(&reclaim_lock);
+}
+
+bool q_set_recycle(struct list_head *head, size_t limit)
+{
     if (!head) {
-        return NULL;
+        return false;
+    }
+
+    queue_t *q = to_queue(head);
+    if (q->arena) {
+        return false;
+    }
+    if (!limit) {
+        pool_detach(q);
+        return true;
+    }
+
+    if (!q->pool) {
+        struct recycle_pool *pool = malloc(sizeof(struct recycle_pool));
+        if (!pool) {
+            return false;
+        }
+
+        memset(pool, 0, sizeof(struct recycle_pool));
+        pool->refs = 1;
+        pool->live = true;
+        q->pool = pool;
+    }
+    q->pool->limit = limit;
+    pool_trim(q->pool, limit);
+    return true;
+}
+
+bool q_recycle_stats(struct list_head *head, recycle_stats_t *stats)
+{
+    if (!head || !to_queue(head)->pool) {
+        return false;
+    }
+
+    const struct recycle_pool *pool = to_queue(head)->pool;
+    stats->hits = pool->hits;
+    stats->misses = pool->misses;
+    stats->cached = pool->cached;
+    return true;
+}
+
+/*
+ * Attempt to insert element at head of queue.
+ * Return true if successful.
+ * Return false if q is NULL or could not allocate space.
+ * Argument s points to the string to be stored.
+ * The function must explicitly allocate space and copy the string into it.
+ */
+element_t *create_element(char *s)
+{
+    element_t *elem = malloc(sizeof(element_t));
+    if (!elem) {
+        return NULL;
+    }
+
+    size_t len = strlen(s);
+    elem->value = str_new(len + 1);
+    if (!elem->value) {
+        free(elem);
+        return NULL;
+    }
+
+    memcpy(elem->value, s, len + 1);
+    set_len(elem, len);
+    return elem;
+}
+
+/*
+ * Create element for s, carving it from the arena of q if it has one, or
+ * taking it from the recycle pool if q recycles.
+ * Return NULL if could not allocate space.
+ */
+static element_t *queue_element(queue_t *q, char *s)
+{
+    if (!q->arena) {
+        if (q->pool) {
+            size_t len = strlen(s);
+            size_t cls = 0;
+            while ((RECYCLE_MIN_STRING << cls) < len + 1) {
+                cls++;
+            }
+            /* Longer strings are not worth caching */
+            if (cls < RECYCLE_CLASSES) {
+                return pool_element(q->pool, cls, s, len);
+            }
+        }
+        return create_element(s);
+    }
+
+    size_t len = strlen(s);
+    element_t *elem =
+        arena_alloc(q, sizeof(element_t) + sizeof(shared_str_t) + len + 1);
+    if (!elem) {
+        return NULL;
+    }
+
+    shared_str_t *str = (shared_str_t *) (elem + 1);
+    str->refcnt = STR_ARENA;
+    memcpy(str->data, s, len + 1);
+    elem->value = str->data;
+    set_len(elem, len);
+    return elem;
+}
+
+/*
+ * Copy the value of e to sp, truncated to bufsize - 1 characters.
+ * No effect if sp is NULL.
+ */
+static void copy_value(const element_t *e, char *sp, size_t bufsize)
+{
+    if (!sp || !bufsize) {
+        return;
+    }
+
+    size_t len = e->len < bufsize - 1 ? e->len : bufsize - 1;
+    memcpy(sp, e->value, len);
+    sp[len] = '\0';
+}
+
+bool q_insert_head(struct list_head *head, char *s)
+{
+    if (!head) {
+        return false;
+    }
+
+    queue_t *q = to_list_queue(head);
+    element_t *elem = queue_element(q, s);
+    if (!elem) {
+        return false;
+    }
+
+    q_link_head(q, &elem->list);
+    return true;
+}
+
+/*
+ * Attempt to insert element at tail of queue.
+ * Return true if successful.
+ * Return false if q is NULL or could not allocate space.
+ * Argument s points to the string to be stored.
+ * The function must explicitly allocate space and copy the string into it.
+ */
+bool q_insert_tail(struct list_head *head, char *s)
+{
+    if (!head) {
+        return false;
+    }
+
+    queue_t *q = to_list_queue(head);
+    element_t *elem = queue_element(q, s);
+    if (!elem) {
+        return false;
+    }
+
+    q_link_tail(q, &elem->list);
+    return true;
+}
+
+/*
+ * Attempt to remove element from head of queue.
+ * Return target element.
+ * Return NULL if queue is NULL or empty.
+ * If sp is non-NULL and an element is removed, copy the removed string to *sp
+ * (up to a maximum of bufsize-1 characters, plus a null terminator.)
+ *
+ * NOTE: "remove" is different from "delete"
+ * The space used by the list element and the string should not be freed.
+ * The only thing "remove" need to do is unlink it.
+ *
+ * REF:
+ * https://english.stackexchange.com/questions/52508/difference-between-delete-and-remove
+ */
+element_t *q_remove_head(struct list_head *head, char *sp, size_t bufsize)
+{
+    if (!head) {
+        return NULL;
+    }
+
+    queue_t *q = to_list_queue(head);
+    if (list_empty(head)) {
+        return NULL;
+    }
+
+    element_t *elem = list_entry(q_next(q, head), element_t, list);
+    copy_value(elem, sp, bufsize);
+
+    q_unlink(q, &elem->list, -1);
+    return elem;
+}
+
+/*
+ * Attempt to remove element from tail of queue.
+ * Other attribute is as same as q_remove_head.
+ */
+element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize)
+{
+    if (!head) {
+        return NULL;
+    }
+
+    queue_t *q = to_list_queue(head);
+    if (list_empty(head)) {
+        return NULL;
+    }
+
+    element_t *elem = list_entry(q_prev(q, head), element_t, list);
+    copy_value(elem, sp, bufsize);
+
+    q_unlink(q, &elem->list, 1);
+    return elem;
+}
+
+/*
+ * WARN: This is for external usage, don't modify it
+ * Attempt to release element.
+ */
+void q_release_element(element_t *e)
+{
+    element_free(e, true);
+}
+
+char *q_new_string(size_t len)
+{
+    char *s = str_new(len + 1);
+    if (s) {
+        s[len] = '\0';
+    }
+    return s;
+}
+
+void q_free_string(char *s)
+{
+    if (s) {
+        str_put(s);
+    }
+}
+
+/*
+ * Create element adopting string s.  The element is allocated on its own,
+ * since arena elements must keep the string carved along with them.
+ * Return NULL if could not allocate space.
+ */
+static element_t *owned_element(queue_t *q, char *s)
+{
+    element_t *elem = malloc(sizeof(element_t));
+    if (!elem) {
+        return NULL;
+    }
+
+    elem->value = s;
+    set_len(elem, strlen(s));
+    q->loose = true;
+    return elem;
+}
+
+bool q_insert_head_owned(struct list_head *head, char *s)
+{
+    if (!head || !s) {
+        return false;
+    }
+
+    queue_t *q = to_list_queue(head);
+    element_t *elem = owned_element(q, s);
+    if (!elem) {
+        return false;
+    }
+
+    q_link_head(q, &elem->list);
+    return true;
+}
+
+bool q_insert_tail_owned(struct list_head *head, char *s)
+{
+    if (!head || !s) {
+        return false;
+    }
+
+    queue_t *q = to_list_queue(head);
+    element_t *elem = owned_element(q, s);
+    if (!elem) {
+        return false;
+    }
+
+    q_link_tail(q, &elem->list);
+    return true;
+}
+
+/* Removing without a buffer leaves the string where it is */
+element_t *q_remove_head_view(struct list_head *head)
+{
+    return q_remove_head(head, NULL, 0);
+}
+
+element_t *q_remove_tail_view(struct list_head *head)
+{
+    return q_remove_tail(head, NULL, 0);
+}
+
+char *q_take_value(element_t *e)
+{
+    /*
+     * The caller may write to the string, so it is copied unless no other
+     * element refers to it
+     */
+    if (str_bound(e->value) || str_refs(e->value) > 1) {
+        char *copy = str_new(e->len + 1);
+        if (copy) {
+            memcpy(copy, e->value, e->len + 1);
+            q_release_element(e);
+        }
+        return copy;
+    }
+
+    char *value = e->value;
+    free(e);
+    return value;
+}
+
+/*
+ * Create a copy of queue that shares the strings of the original.
+ * Only the elements are allocated; each string gains a reference instead,
+ * unless it lives in an arena and has to be copied.
+ * A partial copy is freed right away if an allocation fails.
+ * Return NULL if q is NULL or could not allocate space.
+ */
+struct list_head *q_clone(struct list_head *head)
+{
+    if (!head) {
+        return NULL;
+    }
+
+    struct list_head *clone = q_new();
+    if (!clone) {
+        return NULL;
+    }
+
+    /* Copy in queue order so that the clone starts without a reversal */
+    queue_t *q = to_list_queue(head);
+    for (struct list_head *node = q_next(q, head); node != head;
+         node = q_next(q, node)) {
+        element_t *elem = malloc(sizeof(element_t));
+        if (!elem) {
+            /* Not q_free, which may hand the copy to another thread */
+            queue_destroy(clone);
+            return NULL;
+        }
+
+        element_t *orig = list_entry(node, element_t, list);
+        elem->value = str_share(orig->value, orig->len);
+        if (!elem->value) {
+            free(elem);
+            queue_destroy(clone);
+            return NULL;
+        }
+        set_len(elem, orig->len);
+        q_link_tail(to_queue(clone), &elem->list);
+    }
+
+    return clone;
+}
+
+/*
+ * Return number of elements whose string is shared with another element.
+ * Return 0 if q is NULL or empty
+ */
+int q_shared(struct list_head *head)
+{
+    if (!head) {
+        return 0;
+    }
+
+    int shared = 0;
+    element_t *entry = NULL;
+    to_list_queue(head);
+    list_for_each_entry (entry, head, list) {
+        if (!str_bound(entry->value) && str_refs(entry->value) > 1) {
+            shared++;
+        }
+    }
+
+    return shared;
+}
+
+/*
+ * Return number of elements in queue.
+ * Return 0 if q is NULL or empty
+ */
+int q_size(struct list_head *head)
+{
+    if (!head) {
+        return 0;
+    }
+
+    return to_queue(head)->size + to_queue(head)->heap_size;
+}
+
+struct list_head *q_mid(struct list_head *head)
+{
+    if (!head || list_empty(head)) {
+        return head;
+    }
+
+    struct list_head *slow = head->next;
+    struct list_head *fast = head->next->next;
+    while (fast && fast != head && fast->next != head) {
+        fast = fast->next->next;
+        slow = slow->next;
+    }
+
+    return slow;
+}
+
+/*
+ * Delete the middle node in list.
+ * The middle node of a linked list of size n is the
+ * ⌊n / 2⌋th node from the start using 0-based indexing.
+ * If there're six element, the third member should be return.
+ * Return true if successful.
+ * Return false if list is NULL or empty.
+ */
+bool q_delete_mid(struct list_head *head)
+{
+    // https://leetcode.com/problems/delete-the-middle-node-of-a-linked-list/
+    if (!head) {
+        return false;
+    }
+
+    queue_t *q = to_list_queue(head);
+    if (list_empty(head)) {
+        return false;
+    }
+
+    struct list_head *mid = q->mid;
+    q_unlink(q, mid, 0);
+    q_release_element(list_entry(mid, element_t, list));
+    return true;
+}
+
+#ifdef QUEUE_PACKED
+/* Prefix of e as a number that orders like the characters it holds */
+static inline uint64_t prefix_key(const element_t *e)
+{
+    uint64_t key;
+    memcpy(&key, e->prefix, sizeof(key));
+    return be64toh(key);
+}
+#endif
+
+/*
+ * Same order as strcmp, but the recorded lengths bound the scan, and strings
+ * shared through q_clone compare equal without being read.  With the packed
+ * layout, strings are only read when their prefixes tie.
+ */
+int cmp(const element_t *e1, const element_t *e2)
+{
+    size_t skip = 0;
+#ifdef QUEUE_PACKED
+    uint64_t k1 = prefix_key(e1), k2 = prefix_key(e2);
+    if (k1 != k2) {
+        return k1 < k2 ? -1 : 1;
+    }
+    /* Strings hold no null bytes, so a tie settles any string this short */
+    if (e1->len <= QUEUE_PREFIX_LEN || e2->len <= QUEUE_PREFIX_LEN) {
+        return (e1->len > e2->len) - (e1->len < e2->len);
+    }
+    skip = QUEUE_PREFIX_LEN;
+#endif
+    if (e1->value == e2->value) {
+        return 0;
+    }
+
+    size_t len = e1->len < e2->len ? e1->len : e2->len;
+    int res = memcmp(e1->value + skip, e2->value + skip, len - skip);
+    if (res) {
+        return res;
+    }
+    return (e1->len > e2->len) - (e1->len < e2->len);
+}
+
+/* Strings of different lengths differ without being read */
+static inline bool equal(const element_t *e1, const element_t *e2)
+{
+#ifdef QUEUE_PACKED
+    if (memcmp(e1->prefix, e2->prefix, QUEUE_PREFIX_LEN)) {
+        return false;
+    }
+#endif
+    return e1->len == e2->len &&
+           (e1->value == e2->value || !memcmp(e1->value, e2->value, e1->len));
+}
+
+/*
+ * Delete all nodes that have duplicate string,
+ * leaving only distinct strings from the original list.
+ * Return true if successful.
+ * Return false if list is NULL.
+ *
+ * Note: this function always be called after sorting, in other words,
+ * list is guaranteed to be sorted in ascending order.
+ */
+bool q_delete_dup(struct list_head *head)
+{
+    // https://leetcode.com/problems/remove-duplicates-from-sorted-list-ii/
+    if (!head) {
+        return false;
+    }
+
+    queue_t *q = to_list_queue(head);
+    if (list_empty(head)) {
+        return true;
+    }
+
+    struct list_head *node = NULL;
+    struct list_head *safe = NULL;
+    element_t *cur = NULL;
+    list_for_each_safe (node, safe, head) {
+        element_t *entry = list_entry(node, element_t, list);
+        if (cur && equal(cur, entry)) {
+            list_del(node);
+            q_release_element(entry);
+            q->size--;
+        } else {
+            cur = entry;
+        }
+    }
+
+    q_reset_mid(q);
+    return true;
+}
+
+/*
+ * Attempt to swap every two adjacent nodes.
+ */
+void q_swap(struct list_head *head)
+{
+    // https://leetcode.com/problems/swap-nodes-in-pairs/
+    if (!head) {
+        return;
+    }
+
+    /*
+     * Pairs are formed from the front of the queue, so walk in queue order.
+     * Nodes are relinked rather than values exchanged, since an arena element
+     * must keep the string carved along with it.
+     */
+    queue_t *q = to_list_queue(head);
+    struct list_head *node = q_next(q, head);
+    while (node != head && q_next(q, node) != head) {
+        struct list_head *next = q_next(q, node);
+        if (q->reversed) {
+            list_move_tail(node, next);
+        } else {
+            list_move(node, next);
+        }
+        node = q_next(q, node);
+    }
+    q_reset_mid(q);
+}
+
+/*
+ * Reverse elements in queue
+ * No effect if q is NULL or empty
+ * This function should not allocate or free any list elements
+ * (e.g., by calling q_insert_head, q_insert_tail, or q_remove_head).
+ * It should rearrange the existing ones.
+ *
+ * Only the direction flag of the queue is flipped; the links are rewritten
+ * lazily by q_materialize().
+ */
+void q_reverse(struct list_head *head)
+{
+    if (!head) {
+        return;
+    }
+
+    queue_t *q = to_list_queue(head);
+    if (list_empty(head)) {
+        return;
+    }
+
+    /* The middle index of an even-sized queue moves towards the old front */
+    if (!(q->size & 1)) {
+        q->mid = q_prev(q, q->mid);
+    }
+    q->reversed = !q->reversed;
+}
+
+/*
+ * Rewrite the links so that they follow queue order.
+ * No effect if q is NULL or has no pending reversal.
+ */
+void q_materialize(struct list_head *head)
+{
+    if (!head || !to_list_queue(head)->reversed) {
+        return;
+    }
+
+    to_queue(head)->reversed = false;
+    struct list_head *node = NULL;
+    struct list_head *safe = NULL;
+    list_for_each_safe (node, safe, head) {
+        struct list_head *prev = node->prev;
+        struct list_head *next = node->next;
+        node->prev = next;
+        node->next = prev;
+    }
+
+    struct list_head *head_next = head->next;
+    head->next = head->prev;
+    head->prev = head_next;
+}
+
+void q_iter_begin(struct list_head *head, queue_iter_t *it)
+{
+    it->head = head;
+    it->node = head ? q_next(to_list_queue(head), head) : NULL;
+    it->index = 0;
+}
+
+element_t *q_iter_next(queue_iter_t *it)
+{
+    if (!it->head || it->node == it->head) {
+        return NULL;
+    }
+
+    element_t *e = list_entry(it->node, element_t, list);
+    it->node = q_next(to_queue(it->head), it->node);
+    it->index++;
+    return e;
+}
+
+size_t q_iter_next_batch(queue_iter_t *it, element_t **batch, size_t n)
+{
+    if (!it->head) {
+        return 0;
+    }
+
+    /* Decide the direction once, so that the loops only chase pointers */
+    struct list_head *node = it->node;
+    size_t i = 0;
+    if (to_queue(it->head)->reversed) {
+        for (; i < n && node != it->head; i++, node = node->prev) {
+            batch[i] = list_entry(node, element_t, list);
+        }
+    } else {
+        for (; i < n && node != it->head; i++, node = node->next) {
+            batch[i] = list_entry(node, element_t, list);
+        }
+    }
+
+    it->node = node;
+    it->index += i;
+    return i;
+}
+
+bool q_iter_seek(queue_iter_t *it, size_t index)
+{
+    if (!it->head) {
+        return false;
+    }
+
+    queue_t *q = to_queue(it->head);
+    if (index >= q->size) {
+        it->node = it->head;
+        it->index = q->size;
+        return false;
+    }
+
+    /* The head stands for the position past the back */
+    struct list_head *starts[] = {q_next(q, it->head), q->mid, it->head,
+                                  it->node};
+    size_t positions[] = {0, q->size / 2, q->size, it->index};
+    struct list_head *node = starts[0];
+    size_t pos = positions[0];
+    for (int i = 1; i < 4; i++) {
+        size_t best = pos > index ? pos - index : index - pos;
+        size_t dist = positions[i] > index ? positions[i] - index
+                                           : index - positions[i];
+        if (dist < best) {
+            node = starts[i];
+            pos = positions[i];
+        }
+    }
+
+    for (; pos < index; pos++) {
+        node = q_next(q, node);
+    }
+    for (; pos > index; pos--) {
+        node = q_prev(q, node);
     }
 
-    INIT_LIST_HEAD(head);
-    return head;
+    it->node = node;
+    it->index = index;
+    return true;
 }
 
-/* Free all storage used by queue */
-void q_free(struct list_head *l)
+/* Number of single steps taken along a run before merge starts to gallop */
+#define MIN_GALLOP 7
+
+static inline bool in_run(struct list_head *node,
+                          const element_t *pivot,
+                          bool strict)
 {
-    if (!l) {
-        return;
+    int res = cmp(list_entry(node, element_t, list), pivot);
+    return strict ? res < 0 : res <= 0;
+}
+
+/*
+ * Return the last node of the run at the front of list whose elements are
+ * smaller than pivot, or not larger than it unless strict is set.  The first
+ * node must belong to the run.  After MIN_GALLOP single steps the search
+ * probes at doubling distances and then bisects the last gap, so a long run
+ * costs a logarithmic number of comparisons.
+ */
+static struct list_head *run_end(struct list_head *list,
+                                 const element_t *pivot,
+                                 bool strict)
+{
+    struct list_head *last = list->next;
+    for (int i = 0; i < MIN_GALLOP; i++) {
+        if (last->next == list || !in_run(last->next, pivot, strict))
+            return last;
+        last = last->next;
     }
 
-    element_t *entry = NULL;
-    element_t *safe = NULL;
-    list_for_each_entry_safe (entry, safe, l, list) {
-        list_del(&entry->list);
-        q_release_element(entry);
+    /* last belongs to the run, the node gap steps after it does not */
+    size_t gap = 1;
+    for (;;) {
+        struct list_head *probe = last;
+        size_t dist = 0;
+        while (dist < gap && probe->next != list) {
+            probe = probe->next;
+            dist++;
+        }
+        if (!dist)
+            return last;
+        if (!in_run(probe, pivot, strict)) {
+            gap = dist;
+            break;
+        }
+        last = probe;
+        if (dist < gap)
+            return last;
+        gap <<= 1;
+    }
+
+    while (gap > 1) {
+        size_t half = gap / 2;
+        struct list_head *probe = last;
+        for (size_t i = 0; i < half; i++)
+            probe = probe->next;
+        if (in_run(probe, pivot, strict)) {
+            last = probe;
+            gap -= half;
+        } else {
+            gap = half;
+        }
     }
-    free(l);
+    return last;
 }
 
 /*
- * Attempt to insert element at head of queue.
- * Return true if successful.
- * Return false if q is NULL or could not allocate space.
- * Argument s points to the string to be stored.
- * The function must explicitly allocate space and copy the string into it.
+ * Merge sorted list b into sorted list a, leaving b empty.  Whole runs are
+ * moved with a single splice, and equal elements of a stay before those of b.
  */
-element_t *create_element(char *s)
+static void merge(struct list_head *a, struct list_head *b)
 {
-    element_t *elem = malloc(sizeof(element_t));
-    if (!elem) {
-        return NULL;
+    if (list_empty(a) || list_empty(b)) {
+        list_splice_tail_init(b, a);
+        return;
     }
 
-    int length = strlen(s) + 1;
-    elem->value = malloc(length);
-    if (!elem->value) {
-        free(elem);
-        return NULL;
+    LIST_HEAD(dummy);
+    LIST_HEAD(run);
+    bool from_b = cmp(list_first_entry(b, element_t, list),
+                      list_first_entry(a, element_t, list)) < 0;
+    while (!list_empty(a) && !list_empty(b)) {
+        /* Each run ends where the head of the other list must come next */
+        struct list_head *src = from_b ? b : a;
+        struct list_head *other = from_b ? a : b;
+        list_cut_position(
+            &run, src,
+            run_end(src, list_first_entry(other, element_t, list), from_b));
+        list_splice_tail_init(&run, &dummy);
+        from_b = !from_b;
     }
 
-    strncpy(elem->value, s, length);
-    s[length - 1] = '\0';
-    return elem;
+    list_splice_tail_init(a, &dummy);
+    list_splice_tail_init(b, &dummy);
+    list_splice(&dummy, a);
 }
 
-bool q_insert_head(struct list_head *head, char *s)
+static void merge_sort(struct list_head *head)
 {
-    if (!head) {
-        return false;
+    if (list_empty(head) || head->prev == head->next) {
+        return;
     }
 
-    element_t *elem = create_element(s);
-    if (!elem) {
-        return false;
-    }
+    struct list_head *mid = q_mid(head);
+    LIST_HEAD(new_head);
+    INIT_LIST_HEAD(&new_head);
+    list_cut_position(&new_head, head, mid);
 
-    list_add(&elem->list, head);
-    return true;
+    /* new_head holds the front half, so it goes first to keep ties stable */
+    merge_sort(head);
+    merge_sort(&new_head);
+    merge(&new_head, head);
+    list_splice(&new_head, head);
 }
 
 /*
- * Attempt to insert element at tail of queue.
- * Return true if successful.
- * Return false if q is NULL or could not allocate space.
- * Argument s points to the string to be stored.
- * The function must explicitly allocate space and copy the string into it.
+ * Sort elements of queue in ascending order
+ * No effect if q is NULL or empty. In addition, if q has only one
+ * element, do nothing.
  */
-bool q_insert_tail(struct list_head *head, char *s)
+void q_sort(struct list_head *head)
 {
     if (!head) {
-        return false;
+        return;
     }
 
-    element_t *elem = create_element(s);
-    if (!elem) {
-        return false;
+    /* The old order is discarded, so a pending reversal can be dropped */
+    queue_t *q = to_list_queue(head);
+    q->reversed = false;
+    merge_sort(head);
+    q_reset_mid(q);
+}
+
+/*
+ * Merge sorted queue other into sorted queue head, leaving other empty.
+ * Both queues must be in ascending order; equal elements of head stay before
+ * those of other.
+ * No effect if either queue is NULL or both are the same.
+ */
+void q_merge_two(struct list_head *head, struct list_head *other)
+{
+    if (!head || !other || head == other) {
+        return;
     }
 
-    list_add_tail(&elem->list, head);
-    return true;
+    q_materialize(head);
+    q_materialize(other);
+    queue_t *q = to_queue(head);
+    queue_t *o = to_queue(other);
+    if (o->size) {
+        arena_adopt(q, o);
+    }
+    merge(head, other);
+    q->size += o->size;
+    o->size = 0;
+    o->mid = other;
+    q_reset_mid(q);
 }
 
 /*
- * Attempt to remove element from head of queue.
- * Return target element.
- * Return NULL if queue is NULL or empty.
- * If sp is non-NULL and an element is removed, copy the removed string to *sp
- * (up to a maximum of bufsize-1 characters, plus a null terminator.)
- *
- * NOTE: "remove" is different from "delete"
- * The space used by the list element and the string should not be freed.
- * The only thing "remove" need to do is unlink it.
- *
- * REF:
- * https://english.stackexchange.com/questions/52508/difference-between-delete-and-remove
+ * Rearrange the list so that its n-th node (0-based) is the one it would hold
+ * after sorting, with no larger node before it and no smaller node after it.
+ * Quickselect with three-way partitioning, falling back to merge sort once
+ * the partitions keep turning out unbalanced.  Return the n-th node.
  */
-element_t *q_remove_head(struct list_head *head, char *sp, size_t bufsize)
+static struct list_head *list_select(struct list_head *head,
+                                     size_t n,
+                                     size_t size)
 {
-    if (!head || list_empty(head)) {
-        return NULL;
+    LIST_HEAD(front);
+    LIST_HEAD(back);
+    int budget = 0;
+    for (size_t i = size; i; i >>= 1) {
+        budget += 2;
+    }
+
+    while (size > 1) {
+        if (budget-- == 0) {
+            merge_sort(head);
+            break;
+        }
+
+        /* Median of the first, middle and last node */
+        const element_t *a = list_first_entry(head, element_t, list);
+        const element_t *b = list_entry(q_mid(head), element_t, list);
+        const element_t *c = list_last_entry(head, element_t, list);
+        if (cmp(a, b) > 0) {
+            const element_t *tmp = a;
+            a = b;
+            b = tmp;
+        }
+        const element_t *pivot =
+            cmp(b, c) <= 0 ? b : (cmp(a, c) > 0 ? a : c);
+
+        LIST_HEAD(less);
+        LIST_HEAD(equal);
+        LIST_HEAD(greater);
+        size_t nl = 0, ne = 0;
+        struct list_head *node = NULL;
+        struct list_head *safe = NULL;
+        list_for_each_safe (node, safe, head) {
+            int r = cmp(list_entry(node, element_t, list), pivot);
+            if (r < 0) {
+                list_move_tail(node, &less);
+                nl++;
+            } else if (r == 0) {
+                list_move_tail(node, &equal);
+                ne++;
+            } else {
+                list_move_tail(node, &greater);
+            }
+        }
+
+        if (n < nl) {
+            list_splice(&greater, &back);
+            list_splice(&equal, &back);
+            list_splice(&less, head);
+            size = nl;
+        } else if (n < nl + ne) {
+            list_splice_tail(&less, &front);
+            list_splice(&greater, &back);
+            list_splice(&equal, head);
+            n -= nl;
+            break;
+        } else {
+            list_splice_tail(&less, &front);
+            list_splice_tail(&equal, &front);
+            list_splice(&greater, head);
+            n -= nl + ne;
+            size -= nl + ne;
+        }
     }
 
-    element_t *elem = list_first_entry(head, element_t, list);
-    if (sp) {
-        strncpy(sp, elem->value, bufsize);
-        sp[bufsize - 1] = '\0';
+    struct list_head *nth = head->next;
+    while (n--) {
+        nth = nth->next;
     }
 
-    list_del(head->next);
-    return elem;
+    list_splice(&front, head);
+    list_splice_tail(&back, head);
+    return nth;
 }
 
 /*
- * Attempt to remove element from tail of queue.
- * Other attribute is as same as q_remove_head.
+ * Rearrange queue so that the element at index n (0-based) is the one
+ * q_sort would put there, without sorting the rest.
+ * Return that element.
+ * Return NULL if q is NULL or n is out of range.
  */
-element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize)
+element_t *q_nth_element(struct list_head *head, int n)
 {
-    if (!head || list_empty(head)) {
+    if (!head || n < 0) {
         return NULL;
     }
 
-    element_t *elem = list_last_entry(head, element_t, list);
-    if (sp) {
-        strncpy(sp, elem->value, bufsize);
-        sp[bufsize - 1] = '\0';
+    queue_t *q = to_list_queue(head);
+    if ((size_t) n >= q->size) {
+        return NULL;
     }
 
-    list_del(head->prev);
-    return elem;
+    /* Elements are rearranged anyway, so a pending reversal can be dropped */
+    q->reversed = false;
+    struct list_head *nth = list_select(head, n, q->size);
+    q_reset_mid(q);
+    return list_entry(nth, element_t, list);
 }
 
 /*
- * WARN: This is for external usage, don't modify it
- * Attempt to release element.
+ * Move the k smallest elements of queue to its front in ascending order.
+ * The order of the remaining elements is unspecified.
+ * No effect if q is NULL or k is not positive.
  */
-void q_release_element(element_t *e)
+void q_topk(struct list_head *head, int k)
 {
-    free(e->value);
-    free(e);
+    if (!head || k <= 0) {
+        return;
+    }
+
+    queue_t *q = to_list_queue(head);
+    if ((size_t) k >= q->size) {
+        q_sort(head);
+        return;
+    }
+
+    q->reversed = false;
+    struct list_head *kth = list_select(head, k - 1, q->size);
+
+    LIST_HEAD(smallest);
+    list_cut_position(&smallest, head, kth);
+    merge_sort(&smallest);
+    list_splice(&smallest, head);
+    q_reset_mid(q);
 }
 
 /*
- * Return number of elements in queue.
- * Return 0 if q is NULL or empty
+ * Pairing heap over the list nodes of the elements: while an element is in the
+ * heap, prev points to its first child and next to its next sibling.
  */
-int q_size(struct list_head *head)
-{
-    if (!head) {
-        return 0;
-    }
 
-    int size = 0;
-    struct list_head *node;
-    list_for_each (node, head) {
-        size++;
+/* Link two heap roots, the larger one becomes the first child of the other */
+static struct list_head *pq_link(struct list_head *a, struct list_head *b)
+{
+    const element_t *ea = list_entry(a, element_t, list);
+    const element_t *eb = list_entry(b, element_t, list);
+    if (cmp(eb, ea) < 0) {
+        struct list_head *tmp = a;
+        a = b;
+        b = tmp;
     }
 
-    return size;
+    b->next = a->prev;
+    a->prev = b;
+    return a;
 }
 
-struct list_head *q_mid(struct list_head *head)
+/* Combine a list of siblings into one heap with the two-pass pairing scheme */
+static struct list_head *pq_merge_pairs(struct list_head *first)
 {
-    if (!head || list_empty(head)) {
-        return head;
+    /* Link siblings in pairs from left to right, collecting them reversed */
+    struct list_head *pairs = NULL;
+    while (first) {
+        struct list_head *a = first;
+        struct list_head *b = a->next;
+        if (!b) {
+            a->next = pairs;
+            pairs = a;
+            break;
+        }
+
+        first = b->next;
+        a = pq_link(a, b);
+        a->next = pairs;
+        pairs = a;
     }
 
-    struct list_head *slow = head->next;
-    struct list_head *fast = head->next->next;
-    while (fast && fast != head && fast->next != head) {
-        fast = fast->next->next;
-        slow = slow->next;
+    if (!pairs) {
+        return NULL;
     }
 
-    return slow;
+    /* Then fold the pairs from right to left */
+    struct list_head *root = pairs;
+    pairs = root->next;
+    while (pairs) {
+        struct list_head *next = pairs->next;
+        root = pq_link(root, pairs);
+        pairs = next;
+    }
+
+    root->next = NULL;
+    return root;
 }
 
-/*
- * Delete the middle node in list.
- * The middle node of a linked list of size n is the
- * ⌊n / 2⌋th node from the start using 0-based indexing.
- * If there're six element, the third member should be return.
- * Return true if successful.
- * Return false if list is NULL or empty.
- */
-bool q_delete_mid(struct list_head *head)
+static void pq_insert(queue_t *q, struct list_head *node)
 {
-    // https://leetcode.com/problems/delete-the-middle-node-of-a-linked-list/
-    if (!head || list_empty(head)) {
-        return false;
-    }
+    node->prev = NULL;
+    node->next = NULL;
+    q->heap = q->heap ? pq_link(q->heap, node) : node;
+    q->heap_size++;
+}
 
-    struct list_head *mid = q_mid(head);
-    list_del(mid);
-    q_release_element(list_entry(mid, element_t, list));
-    return true;
+static struct list_head *pq_pop(queue_t *q)
+{
+    struct list_head *root = q->heap;
+    q->heap = pq_merge_pairs(root->prev);
+    q->heap_size--;
+    return root;
 }
 
-int cmp(const element_t *e1, const element_t *e2)
+/* Move the elements in the list into the heap */
+static void pq_absorb(queue_t *q)
 {
-    const char *a = e1->value;
-    const char *b = e2->value;
+    struct list_head *node = NULL;
+    struct list_head *safe = NULL;
+    list_for_each_safe (node, safe, &q->head) {
+        pq_insert(q, node);
+    }
+
+    INIT_LIST_HEAD(&q->head);
+    q->reversed = false;
+    q->size = 0;
+    q->mid = &q->head;
+}
 
-    return strcmp(a, b);
+/* Move the elements in the heap back into the list, in ascending order */
+static void pq_flush(queue_t *q)
+{
+    q->reversed = false;
+    while (q->heap) {
+        q_link_tail(q, pq_pop(q));
+    }
 }
 
 /*
- * Delete all nodes that have duplicate string,
- * leaving only distinct strings from the original list.
+ * Attempt to push element into priority queue.
  * Return true if successful.
- * Return false if list is NULL.
- *
- * Note: this function always be called after sorting, in other words,
- * list is guaranteed to be sorted in ascending order.
+ * Return false if q is NULL or could not allocate space.
  */
-bool q_delete_dup(struct list_head *head)
+bool q_pq_push(struct list_head *head, char *s)
 {
-    // https://leetcode.com/problems/remove-duplicates-from-sorted-list-ii/
     if (!head) {
         return false;
     }
 
-    if (list_empty(head)) {
-        return true;
+    queue_t *q = to_queue(head);
+    element_t *elem = queue_element(q, s);
+    if (!elem) {
+        return false;
     }
 
-    struct list_head *node = NULL;
-    struct list_head *safe = NULL;
-    element_t *cur = NULL;
-    list_for_each_safe (node, safe, head) {
-        element_t *entry = list_entry(node, element_t, list);
-        if (cur && cmp(cur, entry) == 0) {
-            list_del(node);
-            q_release_element(entry);
-        } else {
-            cur = entry;
-        }
+    if (!list_empty(head)) {
+        pq_absorb(q);
     }
-
+    pq_insert(q, &elem->list);
     return true;
 }
 
 /*
- * Attempt to swap every two adjacent nodes.
+ * Return the smallest element of priority queue without removing it.
+ * Return NULL if queue is NULL or empty.
  */
-void q_swap(struct list_head *head)
+element_t *q_pq_peek(struct list_head *head)
 {
-    // https://leetcode.com/problems/swap-nodes-in-pairs/
-    if (!head || list_empty(head)) {
-        return;
+    if (!head) {
+        return NULL;
     }
 
-    element_t *entry = NULL;
-    list_for_each_entry (entry, head, list) {
-        element_t *next_entry = list_entry(entry->list.next, element_t, list);
-        if (&next_entry->list != head) {
-            char *temp = entry->value;
-            entry->value = next_entry->value;
-            next_entry->value = temp;
-            entry = next_entry;
-        } else {
-            break;
-        }
+    queue_t *q = to_queue(head);
+    if (!list_empty(head)) {
+        pq_absorb(q);
     }
+    return q->heap ? list_entry(q->heap, element_t, list) : NULL;
 }
 
 /*
- * Reverse elements in queue
- * No effect if q is NULL or empty
- * This function should not allocate or free any list elements
- * (e.g., by calling q_insert_head, q_insert_tail, or q_remove_head).
- * It should rearrange the existing ones.
+ * Attempt to remove the smallest element of priority queue.
+ * Other attribute is as same as q_remove_head.
  */
-void q_reverse(struct list_head *head)
+element_t *q_pq_pop_min(struct list_head *head, char *sp, size_t bufsize)
 {
-    if (!head || list_empty(head)) {
-        return;
+    element_t *elem = q_pq_peek(head);
+    if (!elem) {
+        return NULL;
     }
 
-    struct list_head *node = NULL;
-    struct list_head *safe = NULL;
-    list_for_each_safe (node, safe, head) {
-        struct list_head *prev = node->prev;
-        struct list_head *next = node->next;
-        node->prev = next;
-        node->next = prev;
-    }
+    copy_value(elem, sp, bufsize);
 
-    struct list_head *head_next = head->next;
-    head->next = head->prev;
-    head->prev = head_next;
+    pq_pop(to_queue(head));
+    return elem;
 }
 
-void merge(struct list_head *a, struct list_head *b)
+/*
+ * Move all elements of other into priority queue head, leaving other empty.
+ * No effect if either queue is NULL or both are the same.
+ */
+void q_pq_meld(struct list_head *head, struct list_head *other)
 {
-    LIST_HEAD(dummy);
-    INIT_LIST_HEAD(&dummy);
-    while (!list_empty(a) && !list_empty(b)) {
-        if (cmp(list_first_entry(a, element_t, list),
-                list_first_entry(b, element_t, list)) < 0) {
-            list_move_tail(a->next, &dummy);
-
-        } else {
-            list_move_tail(b->next, &dummy);
-        }
+    if (!head || !other || head == other) {
+        return;
     }
 
-    if (!list_empty(a)) {
-        list_splice_tail_init(a, &dummy);
+    queue_t *q = to_queue(head);
+    queue_t *o = to_queue(other);
+    if (!list_empty(head)) {
+        pq_absorb(q);
     }
-
-    if (!list_empty(b)) {
-        list_splice_tail_init(b, &dummy);
+    if (!list_empty(other)) {
+        pq_absorb(o);
     }
-
-    list_splice(&dummy, a);
-}
-
-/*
- * Sort elements of queue in ascending order
- * No effect if q is NULL or empty. In addition, if q has only one
- * element, do nothing.
- */
-void q_sort(struct list_head *head)
-{
-    if (!head || list_empty(head) || head->prev == head->next) {
+    if (!o->heap) {
         return;
     }
 
-    struct list_head *mid = q_mid(head);
-    LIST_HEAD(new_head);
-    INIT_LIST_HEAD(&new_head);
-    list_cut_position(&new_head, head, mid);
-
-    q_sort(head);
-    q_sort(&new_head);
-    merge(head, &new_head);
+    arena_adopt(q, o);
+    q->heap = q->heap ? pq_link(q->heap, o->heap) : o->heap;
+    q->heap_size += o->heap_size;
+    o->heap = NULL;
+    o->heap_size = 0;
 }
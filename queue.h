@@ -12,13 +12,31 @@
 #include <stddef.h>
 #include "list.h"
 
+/* Number of leading characters of value kept in the packed layout */
+#define QUEUE_PREFIX_LEN 8
+
 /* Linked list element */
 typedef struct {
+#ifdef QUEUE_PACKED
+    /*
+     * Packed layout, selected by building with PACKED=1: the members read
+     * while walking and comparing fill the first 32 bytes, so that sorting
+     * and deduplication only touch the string itself when prefixes tie.
+     */
+    struct list_head list;
+    size_t len;
+    /* Leading characters of value, padded with null bytes */
+    char prefix[QUEUE_PREFIX_LEN];
+    char *value;
+#else
     /* Pointer to array holding string.
      * This array needs to be explicitly allocated and freed
      */
     char *value;
+    /* Length of value, not counting the terminating null byte */
+    size_t len;
     struct list_head list;
+#endif
 } element_t;
 
 /* Operations on queue */
@@ -29,12 +47,61 @@ typedef struct {
  */
 struct list_head *q_new();
 
+/*
+ * Create empty queue whose elements and strings are carved from large blocks
+ * owned by the queue, so that q_free releases a handful of blocks whatever
+ * the length of the queue.
+ * Elements removed from such a queue stay usable until the queue is freed;
+ * q_release_element has no effect on them.
+ * Return NULL if could not allocate space.
+ */
+struct list_head *q_new_arena();
+
 /*
  * Free ALL storage used by queue.
  * No effect if q is NULL
  */
 void q_free(struct list_head *head);
 
+/*
+ * Enable or disable deferred freeing.
+ * While enabled, q_free detaches the queue in O(1) time and leaves the
+ * elements to a reclamation thread, which frees them in the background.
+ */
+void q_set_deferred_free(bool deferred);
+
+/*
+ * Wait until every queue passed to q_free in deferred mode has been freed.
+ */
+void q_free_sync();
+
+/* Statistics of the recycle cache of a queue */
+typedef struct {
+    /* Elements taken from the cache */
+    size_t hits;
+    /* Elements allocated because the cache had none of the right size */
+    size_t misses;
+    /* Elements in the cache */
+    size_t cached;
+} recycle_stats_t;
+
+/*
+ * Make queue recycle its elements.  Released elements and their string
+ * buffers are cached, up to limit of them, and reused by later inserts of
+ * strings that fit.  Strings of a recycling queue are copied by q_clone and
+ * q_take_value instead of shared.  A limit of 0 stops recycling and frees the
+ * cache.  Arena-backed queues cannot recycle.
+ * Return true if successful.
+ * Return false if q is NULL, arena-backed or could not allocate space.
+ */
+bool q_set_recycle(struct list_head *head, size_t limit);
+
+/*
+ * Fill in statistics of the recycle cache of queue.
+ * Return false if q is NULL or does not recycle.
+ */
+bool q_recycle_stats(struct list_head *head, recycle_stats_t *stats);
+
 /*
  * Attempt to insert element at head of queue.
  * Return true if successful.
@@ -80,6 +147,81 @@ element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize);
  */
 void q_release_element(element_t *e);
 
+/*
+ * Ownership-transferring operations.
+ * A string allocated by q_new_string can be handed over to a queue without
+ * being copied, and a removed element can hand its string back the same way,
+ * so that values pass through a pipeline of queues copy-free.
+ */
+
+/*
+ * Allocate space for a string of len characters and a null terminator, which
+ * the caller fills in and may hand over to q_insert_head_owned or
+ * q_insert_tail_owned.
+ * Return NULL if could not allocate space.
+ */
+char *q_new_string(size_t len);
+
+/*
+ * Release string obtained from q_new_string or q_take_value that was not
+ * handed over to a queue.
+ * No effect if s is NULL.
+ */
+void q_free_string(char *s);
+
+/*
+ * Attempt to insert element at head of queue, adopting string s instead of
+ * copying it.  s must come from q_new_string or q_take_value; the queue owns
+ * it on success, and the caller still does on failure.
+ * Return true if successful.
+ * Return false if q or s is NULL or could not allocate space.
+ */
+bool q_insert_head_owned(struct list_head *head, char *s);
+
+/*
+ * Attempt to insert element at tail of queue, adopting string s.
+ * Other attribute is as same as q_insert_head_owned.
+ */
+bool q_insert_tail_owned(struct list_head *head, char *s);
+
+/*
+ * Attempt to remove element from head of queue without copying its string.
+ * The caller reads the value in place, then calls q_release_element or
+ * q_take_value.
+ * Return NULL if queue is NULL or empty.
+ */
+element_t *q_remove_head_view(struct list_head *head);
+
+/*
+ * Attempt to remove element from tail of queue without copying its string.
+ * Other attribute is as same as q_remove_head_view.
+ */
+element_t *q_remove_tail_view(struct list_head *head);
+
+/*
+ * Release removed element e, but hand its string over to the caller, who
+ * owns it like one obtained from q_new_string.  Strings carved from an arena,
+ * taken from a recycle cache or shared with a clone are copied.
+ * Return NULL if could not allocate space, in which case e is left alone.
+ */
+char *q_take_value(element_t *e);
+
+/*
+ * Create a copy of queue which shares the strings of the original.
+ * Only the links are duplicated; each string is reference counted and
+ * released when the last element referring to it is released.  Strings of an
+ * arena-backed or recycling queue are copied instead.
+ * Return NULL if q is NULL or could not allocate space.
+ */
+struct list_head *q_clone(struct list_head *head);
+
+/*
+ * Return number of elements whose string is shared with another element,
+ * e.g. through q_clone.
+ * Return 0 if q is NULL or empty
+ */
+int q_shared(struct list_head *head);
+
 /*
  * Return number of elements in queue.
  * Return 0 if q is NULL or empty
@@ -120,9 +262,64 @@ void q_swap(struct list_head *head);
  * This function should not allocate or free any list elements
  * (e.g., by calling q_insert_head, q_insert_tail, or q_remove_head).
  * It should rearrange the existing ones.
+ * The reversal is recorded in the queue header and takes O(1) time; all
+ * queue operations honor it.
  */
 void q_reverse(struct list_head *head);
 
+/*
+ * Apply any pending reversal to the links of the queue.
+ * Must be called before walking the queue directly with list.h, so that
+ * head->next is the first element in queue order.
+ * No effect if q is NULL.
+ */
+void q_materialize(struct list_head *head);
+
+/*
+ * Iterators.
+ * An iterator walks a queue in queue order, honoring any pending reversal,
+ * without the caller relying on how the elements are linked.  Any operation
+ * that adds, removes or rearranges elements invalidates iterators on the
+ * queue; start them over with q_iter_begin.
+ */
+
+/* Position in a queue; its members are private to the implementation */
+typedef struct {
+    struct list_head *head;
+    /* Node of the element q_iter_next returns next, or head at the end */
+    struct list_head *node;
+    size_t index;
+} queue_iter_t;
+
+/*
+ * Position iterator it at the first element of queue.
+ * If q is NULL, the iterator starts at the end.
+ */
+void q_iter_begin(struct list_head *head, queue_iter_t *it);
+
+/*
+ * Return the element at the position of iterator and advance past it.
+ * Return NULL if the iterator is at the end.
+ */
+element_t *q_iter_next(queue_iter_t *it);
+
+/*
+ * Store up to n elements from the position of iterator into batch, in queue
+ * order, and advance past them.
+ * Return the number of elements stored, which is less than n only at the end
+ * of the queue.
+ */
+size_t q_iter_next_batch(queue_iter_t *it, element_t **batch, size_t n);
+
+/*
+ * Position iterator at index (0-based), walking from whichever of the front,
+ * the middle, the back and the current position is nearest.
+ * Return true if successful.
+ * Return false if index is out of range, in which case the iterator is left
+ * at the end.
+ */
+bool q_iter_seek(queue_iter_t *it, size_t index);
+
 /*
  * Sort elements of queue in ascending order
  * No effect if q is NULL or empty. In addition, if q has only one
@@ -130,4 +327,66 @@ void q_reverse(struct list_head *head);
  */
 void q_sort(struct list_head *head);
 
+/*
+ * Merge sorted queue other into sorted queue head, leaving other empty.
+ * Both queues must be in ascending order; equal elements of head stay before
+ * those of other.  Runs of elements from one queue are moved together, so
+ * merging queues that hardly interleave takes few comparisons.
+ * No effect if either queue is NULL or both are the same.
+ */
+void q_merge_two(struct list_head *head, struct list_head *other);
+
+/*
+ * Rearrange queue so that the element at index n (0-based) is the one q_sort
+ * would put there, with no larger element before it and no smaller element
+ * after it.  Takes O(n) expected time.
+ * Return that element.
+ * Return NULL if q is NULL or n is out of range.
+ */
+element_t *q_nth_element(struct list_head *head, int n);
+
+/*
+ * Move the k smallest elements of queue to its front in ascending order,
+ * without sorting the rest.  Takes O(n + k log k) expected time.
+ * No effect if q is NULL or k is not positive.
+ */
+void q_topk(struct list_head *head, int k);
+
+/*
+ * Priority queue operations.
+ * The elements of a queue used with these functions are kept in a pairing
+ * heap ordered the same way as q_sort.  Any list element is moved into the
+ * heap on first use, and any other queue operation moves the elements back
+ * into the list in ascending order.
+ */
+
+/*
+ * Attempt to push element into priority queue in O(1) time.
+ * Return true if successful.
+ * Return false if q is NULL or could not allocate space.
+ * Argument s points to the string to be stored.
+ * The function must explicitly allocate space and copy the string into it.
+ */
+bool q_pq_push(struct list_head *head, char *s);
+
+/*
+ * Return the smallest element of priority queue without removing it.
+ * Return NULL if queue is NULL or empty.
+ */
+element_t *q_pq_peek(struct list_head *head);
+
+/*
+ * Attempt to remove the smallest element of priority queue, in amortized
+ * O(log n) time.
+ * Other attribute is as same as q_remove_head.
+ */
+element_t *q_pq_pop_min(struct list_head *head, char *sp, size_t bufsize);
+
+/*
+ * Move all elements of other into priority queue head, leaving other empty.
+ * Takes O(1) time if both queues already hold their elements in the heap.
+ * No effect if either queue is NULL or both are the same.
+ */
+void q_pq_meld(struct list_head *head, struct list_head *other);
+
 #endif /* LAB0_QUEUE_H */
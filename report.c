@@ -220,6 +220,10 @@ void *calloc_or_fail(size_t cnt, size_t bytes, char *fun_name)
     return p;
 }
 
+/*
+ * Saved strings are preceded by their length, so that free_string can account
+ * for them without scanning them again
+ */
 char *strsave_or_fail(char *s, char *fun_name)
 {
     if (!s)
@@ -227,9 +231,11 @@ char *strsave_or_fail(char *s, char *fun_name)
 
     size_t len = strlen(s);
     check_exceed(len + 1);
-    char *ss = malloc(len + 1);
-    if (!ss)
+    size_t *lenp = malloc(sizeof(size_t) + len + 1);
+    if (!lenp)
         fail_fun("strsave failed in %s", fun_name);
+    *lenp = len;
+    char *ss = (char *) (lenp + 1);
 
     allocate_cnt++;
     allocate_bytes += len + 1;
@@ -237,7 +243,7 @@ char *strsave_or_fail(char *s, char *fun_name)
     peak_bytes = MAX(peak_bytes, current_bytes);
     last_peak_bytes = MAX(last_peak_bytes, current_bytes);
 
-    return strncpy(ss, s, len + 1);
+    return memcpy(ss, s, len + 1);
 }
 
 /* Free block, as from malloc, realloc, or strsave */
@@ -267,9 +273,20 @@ void free_array(void *b, size_t cnt, size_t bytes)
 /* Free string saved by strsave_or_fail */
 void free_string(char *s)
 {
-    if (!s)
+    if (!s) {
         report_event(MSG_ERROR, "Attempting to free null block");
-    free_block((void *) s, strlen(s) + 1);
+        return;
+    }
+
+    size_t *lenp = (size_t *) s - 1;
+    free_block((void *) lenp, *lenp + 1);
+}
+
+void memory_usage(size_t *blocks, size_t *bytes, size_t *peak)
+{
+    *blocks = allocate_cnt - free_cnt;
+    *bytes = current_bytes;
+    *peak = peak_bytes;
 }
 
 /* Initialization of timers */
@@ -49,6 +49,12 @@ void free_array(void *b, size_t cnt, size_t bytes);
 /* Free string saved by strsave_or_fail */
 void free_string(char *s);
 
+/*
+ * Number and bytes of the blocks allocated by the functions above, and the
+ * most bytes there ever were
+ */
+void memory_usage(size_t *blocks, size_t *bytes, size_t *peak);
+
 /** Time measurement.  **/
 
 /* Time counted as fp number in seconds */
@@ -35,7 +35,30 @@ class Tracer:
         14: "trace-14-perf",
         15: "trace-15-perf",
         16: "trace-16-perf",
-        17: "trace-17-complexity"
+        17: "trace-17-complexity",
+        18: "trace-18-clone",
+        19: "trace-19-pq",
+        20: "trace-20-select",
+        21: "trace-21-merge",
+        22: "trace-22-arena",
+        23: "trace-23-deferfree",
+        24: "trace-24-typed",
+        25: "trace-25-longstr",
+        26: "trace-26-owned",
+        27: "trace-27-recycle",
+        28: "trace-28-iter",
+        29: "trace-29-cautious",
+        30: "trace-30-guard",
+        31: "trace-31-threads",
+        32: "trace-32-oom",
+        33: "trace-33-realloc",
+        34: "trace-34-quarantine",
+        35: "trace-35-budget",
+        36: "trace-36-mem",
+        37: "trace-37-backtrace",
+        38: "trace-38-hist",
+        39: "trace-39-detach",
+        40: "trace-40-take"
     }
 
     traceProbs = {
@@ -55,10 +78,33 @@ class Tracer:
         14: "Trace-14",
         15: "Trace-15",
         16: "Trace-16",
-        17: "Trace-17"
+        17: "Trace-17",
+        18: "Trace-18",
+        19: "Trace-19",
+        20: "Trace-20",
+        21: "Trace-21",
+        22: "Trace-22",
+        23: "Trace-23",
+        24: "Trace-24",
+        25: "Trace-25",
+        26: "Trace-26",
+        27: "Trace-27",
+        28: "Trace-28",
+        29: "Trace-29",
+        30: "Trace-30",
+        31: "Trace-31",
+        32: "Trace-32",
+        33: "Trace-33",
+        34: "Trace-34",
+        35: "Trace-35",
+        36: "Trace-36",
+        37: "Trace-37",
+        38: "Trace-38",
+        39: "Trace-39",
+        40: "Trace-40"
     }
 
-    maxScores = [0, 5, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 5]
+    maxScores = [0, 5, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 5, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6]
 
     RED = '\033[91m'
     GREEN = '\033[92m'
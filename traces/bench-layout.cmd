@@ -0,0 +1,15 @@
+# Benchmark of the element layout.  Run it on builds with and without
+# PACKED=1, and compare the time and cache misses of each command.
+option fail 0
+option malloc 0
+option verbose 1
+new
+it RAND 150000
+time size
+time iter 64
+time sort
+time dedup
+time iter 64
+reverse
+time sort
+free
@@ -1,5 +1,6 @@
 # Test of malloc failure on insert_head
 option fail 30
+option seed 1
 option malloc 0
 new
 option malloc 25
@@ -1,5 +1,6 @@
 # Test of malloc failure on insert_tail
 option fail 50
+option seed 1
 option malloc 0
 new
 ih jaguar 20
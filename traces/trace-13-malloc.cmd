@@ -1,5 +1,6 @@
 # Test of malloc failure on new
 option fail 10
+option seed 1
 option malloc 50
 new
 new
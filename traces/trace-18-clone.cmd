@@ -0,0 +1,28 @@
+# Test of clone and restore around destructive operations
+option fail 0
+option malloc 0
+new
+ih gerbil
+ih bear
+ih dolphin
+it meerkat
+it bear
+it gerbil
+clone
+sort
+rh bear
+rh bear
+rh dolphin
+restore
+rh dolphin
+rh bear
+rh gerbil
+clone
+reverse
+dedup
+rh gerbil
+restore
+rh meerkat
+rh bear
+rh gerbil
+free
@@ -0,0 +1,27 @@
+# Test of priority queue push, pop, meld and drain
+option fail 0
+option malloc 0
+new
+pqpush gerbil
+pqpush bear
+pqpush dolphin
+it aardvark
+pqpush meerkat
+pqpop aardvark
+pqpop bear
+clone
+pqmeld
+size
+pqpop dolphin
+pqpop dolphin
+pqpop gerbil
+ih zebra
+rh zebra
+rh gerbil
+pqdrain
+size
+ih RAND 100000
+pqpop
+pqpop
+pqdrain
+free
@@ -0,0 +1,31 @@
+# Test of nth element selection and top-k without full sort
+option fail 0
+option malloc 0
+new
+ih gerbil
+ih bear
+ih dolphin
+it meerkat
+it aardvark
+it bear
+it zebra
+nth 3 dolphin
+nth 0 aardvark
+nth 6 zebra
+reverse
+topk 3
+rh aardvark
+rh bear
+rh bear
+size
+topk 10
+rh dolphin
+rh gerbil
+rh meerkat
+rh zebra
+free
+new
+ih RAND 500000
+topk 100
+nth 250000
+free
@@ -0,0 +1,36 @@
+# Test of merging sorted queues
+option fail 0
+option malloc 0
+new
+it bear
+it dolphin
+it gerbil
+clone
+ih aardvark
+it zebra
+merge
+size
+rh aardvark
+rh bear
+rh bear
+rh dolphin
+rh dolphin
+rh gerbil
+rh gerbil
+rh zebra
+free
+new
+ih RAND 200000
+sort
+clone
+merge
+size
+free
+new
+ih meerkat 200000
+clone
+ih aardvark 200000
+it zebra 200000
+merge
+size
+free
@@ -0,0 +1,26 @@
+# Test of arena-backed queues
+option fail 0
+option malloc 0
+option arena 1
+new
+ih dolphin
+ih bear
+it gerbil
+it meerkat
+swap
+rh dolphin
+dm
+clone
+rt gerbil
+ih zebra
+restore
+size
+rh bear
+rh gerbil
+free
+new
+ih dolphin 1000000
+it gerbil 1000000
+reverse
+sort
+free
@@ -0,0 +1,23 @@
+# Test of deferred free on the reclamation thread
+option fail 0
+option malloc 0
+option deferfree 1
+new
+ih dolphin
+ih bear
+it gerbil
+clone
+rh bear
+restore
+rh bear
+rh dolphin
+free
+new
+ih dolphin 1000000
+it gerbil 1000000
+clone
+free
+option deferfree 0
+new
+ih RAND 1000
+free
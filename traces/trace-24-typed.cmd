@@ -0,0 +1,10 @@
+# Test of typed queues holding integers and records inline
+typed 1
+typed 2
+typed 10
+typed 1000
+typed 100000
+oom typed 20
+option fail 10
+option malloc 20
+typed 1000
@@ -0,0 +1,24 @@
+# Test of long strings of different lengths sharing prefixes
+option fail 0
+option malloc 0
+new
+it kemubcrdlsbqgbcnnchcrnbsdhuusbssmbhbrejnerdsjrvfdssugldrwcsbtgpvrnykosoljhzfwyhcsjqpkxojtcdqnfykepnbvcyrszkkwltpszoccipwvcbxwjusvojwmvlaolftdpbgyjexhmmpcfomrienriwnlvmhecfehvhapsfijaenrltskewqtuvxboyvzrmmmmdpumbgcgofdktbdaserdltacgtmeuiltlpddpoppjcedxkxipwfqagqlewrayqjucwiqlflyhrryqkuhtzzygzhmxzhgqplxaazipigwtlozxllchdhpgkgpttapulzucvdmzwygpfnzukczxmomxcxffeaesozuettpvlerreaazxudqxenggaigjqhyskirnebxlovsqnqereqqaoyftayzefeptxdrbkvqqrpzydrbhgibydqoraycoktqtqgwioqrzpqhwqirgoendmokcvhncgvjzdyewuvleieohxdmpfvhfwnqmknglkcxlakroowamkqtjqcdzhdciibyfiyenvimerqspwkcibzwfnciauczicthcidoakrnitebqwhdfibfgjujqygjoqvfilzaibaaxqrgqphodvunvprmqjwghkgwxuemlbeacuxinfbcvmqvjthwjboffioailkrkhbjglfakmcpiqughqyacicemsbmajjuhcsqyevwztmykxpejxtuebwqunxwzqeqyqszavszwvwuhcabeuldmorbuaurvhpiaozcxqrcvqcxxpizcihxyghxuopmcpvjybtuugctekiuxwjtseapbpivdwgvpjwqjoooydrgjcpajocqoimggcscexqiletuqidwlhppmafapvomjxenlmkdkakykmdgwaxjilcmmsclnyibidbvjuehinqkgylznazyumrrgxcbxnotyeujpbrefpnkjjixxuimuhjprvmdfufcgqzprhokyonerghcfkrckhlizsgaxnmnxqgmikybp 3
+it kemubcrdlsbqgbcnnchcrnbsdhuusbssmbhbrejnerdsjrvfdssugldrwcsbtgpvrnykosoljhzfwyhcsjqpkxojtcdqnfykepnbvcyrszkkwltpszoccipwvcbxwjusvojwmvlaolftdpbgyjexhmmpcfomrienriwnlvmhecfehvhapsfijaenrltskewqtuvxboyvzrmmmmdpumbgcgofdktbdaserdltacgtmeuiltlpddpoppjcedxkxipwfqagqlewrayqjucwiqlflyhrryqkuhtzzygzhmxzhgqplxaazipigwtlozxllchdhpgkgpttapulzucvdmzwygpfnzukczxmomxcxffeaesozuettpvlerreaazxudqxenggaigjqhyskirnebxlovsqnqereqqaoyftayzefeptxdrbkvqqrpzydrbhgibydqoraycoktqtqgwioqrzpqhwqirgoendmokcvhncgvjzdyewuvleieohxdmpfvhfwnqmknglkcxlakroowamkqtjqcdzhdciibyfiyenvimerqspwkcibzwfnciauczicthcidoakrnitebqwhdfibfgjujqygjoqvfilzaibaaxqrgqphodvunvprmqjwghkgwxuemlbeacuxinfbcvmqvjthwjboffioailkrkhbjglfakmcpiqughqyacicemsbmajjuhcsqyevwztmykxpejxtuebwqunxwzqeqyqszavszwvwuhcabeuldmorbuaurvhpiaozcxqrcvqcxxpizcihxyghxuopmcpvjybtuugctekiuxwjtseapbpivdwgvpjwqjoooydrgjcpajocqoimggcscexqiletuqidwlhppmafapvomjxenlmkdkakykmdgwaxjilcmmsclnyibidbvjuehinqkgylznazyumrrgxcbxnotyeujpbrefpnkjjixxuimuhjprvmdfufcgqzprhokyonerghcf 2
+ih kemubcrdlsbqgbcnnchcrnbsdhuusbssmbhbrejnerdsjrvfdssugldrwcsbtgpvrnykosoljhzfwyhcsjqpkxojtcdqnfykepnbvcyrszkkwltpszoccipwvcbxwjusvojwmvlaolftdpbgyjexhmmpcfomrienriwnlvmhecfehvhapsfijaenrltskewqtuvxboyvzrmmmmdpumbgcgofdktbdaserdltacgtmeuiltlpddpoppjcedxkxipwfqagqlewrayqjucwiqlflyhrryqkuhtzzygzhmxzhgqplxaazipigwtlozxllchdhpgkgpttapulzucvdmzwygpfnzukczxmomxcxffeaesozuettpvlerreaazxudqxenggaigjqhyskirnebxlovsqnqereqqaoyftayzefeptxdrbkvqqrpzydrbhgibydqoraycoktqtqgwioqrzpqhwqirgoendmokcvhncgvjzdyewuvleieohxdmpfvhfwnqmknglkcxlakroowamkqtjqcdzhdciibyfiyenvimerqspwkcibzwfnciauczicthcidoakrnitebqwhdfibfgjujqygjoqvfilzaibaaxqrgqphodvunvprmqjwghkgwxuemlbeacuxinfbcvmqvjthwjboffioailkrkhbjglfakmcpiqughqyacicemsbmajjuhcsqyevwztmykxpejxtuebwqunxwzqeqyqszavszwvwuhcabeuldmorbuaurvhpiaozcxqrcvqcxxpizcihxyghxuopmcpvjybtuugctekiuxwjtseapbpivdwgvpjwqjoooydrgjcpajocqoimggcscexqiletuqidwlhppmafapvomjxenlmkdkakykmdgwaxjilcmmsclnyibidbvjuehinqkgylznazyumrrgxcbxnotyeujpbrefpnkjjixxuimuhjprvmdfufcgqzprhokyonerghcfkrckhlizsgaxnmnxqgmikybz
+ih kemubcrdlsbqgbcnnchcrnbsdhuusbssmbhbrejnerdsjrvfdssugldrwcsbtgpvrnykosoljhzfwyhcsjqpkxojtcdqnfykepnbvcyrszkkwltpszoccipwvcbxwjusvojwmvlaolftdpbgyjexhmmpcfomrienriwnlvmhecfehvhapsfijaenrltskewqtuvxboyvzrmmmmdpumbgcgofdktbdaserdltacgtmeuiltlpddpoppjcedxkxipwfqagqlewrayqjucwiqlflyhrryqkuhtzzygzhmxzhgqplxaazipigwtlozxllchdhpgkgpttapulzucvdmzwygpfnzukczxmomxcxffeaesozuettpvlerreaazxudqxenggaigjqhyskirnebxlovsqnqereqqaoyftayzefeptxdrbkvqqrpzydrbhgibydqoraycoktqtqgwioqrzpqhwqirgoendmokcvhncgvjzdyewuvleieohxdmpfvhfwnqmknglkcxlakroowamkqtjqcdzhdciibyfiyenvimerqspwkcibzwfnciauczicthcidoakrnitebqwhdfibfgjujqygjoqvfilzaibaaxqrgqphodvunvprmqjwghkgwxuemlbeacuxinfbcvmqvjthwjboffioailkrkhbjglfakmcpiqughqyacicemsbmajjuhcsqyevwztmykxpejxtuebwqunxwzqeqyqszavszwvwuhcabeuldmorbuaurvhpiaozcxqrcvqcxxpizcihxyghxuopmcpvjybtuugctekiuxwjtseapbpivdwgvpjwqjoooydrgjcpajocqoimggcscexqiletuqidwlhppmafapvomjxenlmkdkakykmdgwaxjilcmmsclnyibidbvjuehinqkgylznazyumrrgxcbxnotyeujpbrefpnkjjixxuimuhjprvmdfufcgqzprhokyonerghcf
+sort
+dedup
+size
+rh kemubcrdlsbqgbcnnchcrnbsdhuusbssmbhbrejnerdsjrvfdssugldrwcsbtgpvrnykosoljhzfwyhcsjqpkxojtcdqnfykepnbvcyrszkkwltpszoccipwvcbxwjusvojwmvlaolftdpbgyjexhmmpcfomrienriwnlvmhecfehvhapsfijaenrltskewqtuvxboyvzrmmmmdpumbgcgofdktbdaserdltacgtmeuiltlpddpoppjcedxkxipwfqagqlewrayqjucwiqlflyhrryqkuhtzzygzhmxzhgqplxaazipigwtlozxllchdhpgkgpttapulzucvdmzwygpfnzukczxmomxcxffeaesozuettpvlerreaazxudqxenggaigjqhyskirnebxlovsqnqereqqaoyftayzefeptxdrbkvqqrpzydrbhgibydqoraycoktqtqgwioqrzpqhwqirgoendmokcvhncgvjzdyewuvleieohxdmpfvhfwnqmknglkcxlakroowamkqtjqcdzhdciibyfiyenvimerqspwkcibzwfnciauczicthcidoakrnitebqwhdfibfgjujqygjoqvfilzaibaaxqrgqphodvunvprmqjwghkgwxuemlbeacuxinfbcvmqvjthwjboffioailkrkhbjglfakmcpiqughqyacicemsbmajjuhcsqyevwztmykxpejxtuebwqunxwzqeqyqszavszwvwuhcabeuldmorbuaurvhpiaozcxqrcvqcxxpizcihxyghxuopmcpvjybtuugctekiuxwjtseapbpivdwgvpjwqjoooydrgjcpajocqoimggcscexqiletuqidwlhppmafapvomjxenlmkdkakykmdgwaxjilcmmsclnyibidbvjuehinqkgylznazyumrrgxcbxnotyeujpbrefpnkjjixxuimuhjprvmdfufcgqzprhokyonerghcf
+rh kemubcrdlsbqgbcnnchcrnbsdhuusbssmbhbrejnerdsjrvfdssugldrwcsbtgpvrnykosoljhzfwyhcsjqpkxojtcdqnfykepnbvcyrszkkwltpszoccipwvcbxwjusvojwmvlaolftdpbgyjexhmmpcfomrienriwnlvmhecfehvhapsfijaenrltskewqtuvxboyvzrmmmmdpumbgcgofdktbdaserdltacgtmeuiltlpddpoppjcedxkxipwfqagqlewrayqjucwiqlflyhrryqkuhtzzygzhmxzhgqplxaazipigwtlozxllchdhpgkgpttapulzucvdmzwygpfnzukczxmomxcxffeaesozuettpvlerreaazxudqxenggaigjqhyskirnebxlovsqnqereqqaoyftayzefeptxdrbkvqqrpzydrbhgibydqoraycoktqtqgwioqrzpqhwqirgoendmokcvhncgvjzdyewuvleieohxdmpfvhfwnqmknglkcxlakroowamkqtjqcdzhdciibyfiyenvimerqspwkcibzwfnciauczicthcidoakrnitebqwhdfibfgjujqygjoqvfilzaibaaxqrgqphodvunvprmqjwghkgwxuemlbeacuxinfbcvmqvjthwjboffioailkrkhbjglfakmcpiqughqyacicemsbmajjuhcsqyevwztmykxpejxtuebwqunxwzqeqyqszavszwvwuhcabeuldmorbuaurvhpiaozcxqrcvqcxxpizcihxyghxuopmcpvjybtuugctekiuxwjtseapbpivdwgvpjwqjoooydrgjcpajocqoimggcscexqiletuqidwlhppmafapvomjxenlmkdkakykmdgwaxjilcmmsclnyibidbvjuehinqkgylznazyumrrgxcbxnotyeujpbrefpnkjjixxuimuhjprvmdfufcgqzprhokyonerghcfkrckhlizsgaxnmnxqgmikybp
+option length 16
+rh kemubcrdlsbqgbcnnchcrnbsdhuusbssmbhbrejnerdsjrvfdssugldrwcsbtgpvrnykosoljhzfwyhcsjqpkxojtcdqnfykepnbvcyrszkkwltpszoccipwvcbxwjusvojwmvlaolftdpbgyjexhmmpcfomrienriwnlvmhecfehvhapsfijaenrltskewqtuvxboyvzrmmmmdpumbgcgofdktbdaserdltacgtmeuiltlpddpoppjcedxkxipwfqagqlewrayqjucwiqlflyhrryqkuhtzzygzhmxzhgqplxaazipigwtlozxllchdhpgkgpttapulzucvdmzwygpfnzukczxmomxcxffeaesozuettpvlerreaazxudqxenggaigjqhyskirnebxlovsqnqereqqaoyftayzefeptxdrbkvqqrpzydrbhgibydqoraycoktqtqgwioqrzpqhwqirgoendmokcvhncgvjzdyewuvleieohxdmpfvhfwnqmknglkcxlakroowamkqtjqcdzhdciibyfiyenvimerqspwkcibzwfnciauczicthcidoakrnitebqwhdfibfgjujqygjoqvfilzaibaaxqrgqphodvunvprmqjwghkgwxuemlbeacuxinfbcvmqvjthwjboffioailkrkhbjglfakmcpiqughqyacicemsbmajjuhcsqyevwztmykxpejxtuebwqunxwzqeqyqszavszwvwuhcabeuldmorbuaurvhpiaozcxqrcvqcxxpizcihxyghxuopmcpvjybtuugctekiuxwjtseapbpivdwgvpjwqjoooydrgjcpajocqoimggcscexqiletuqidwlhppmafapvomjxenlmkdkakykmdgwaxjilcmmsclnyibidbvjuehinqkgylznazyumrrgxcbxnotyeujpbrefpnkjjixxuimuhjprvmdfufcgqzprhokyonerghcfkrckhlizsgaxnmnxqgmikybz
+size
+free
+option length 1024
+new
+ih kemubcrdlsbqgbcnnchcrnbsdhuusbssmbhbrejnerdsjrvfdssugldrwcsbtgpvrnykosoljhzfwyhcsjqpkxojtcdqnfykepnbvcyrszkkwltpszoccipwvcbxwjusvojwmvlaolftdpbgyjexhmmpcfomrienriwnlvmhecfehvhapsfijaenrltskewqtuvxboyvzrmmmmdpumbgcgofdktbdaserdltacgtmeuiltlpddpoppjcedxkxipwfqagqlewrayqjucwiqlflyhrryqkuhtzzygzhmxzhgqplxaazipigwtlozxllchdhpgkgpttapulzucvdmzwygpfnzukczxmomxcxffeaesozuettpvlerreaazxudqxenggaigjqhyskirnebxlovsqnqereqqaoyftayzefeptxdrbkvqqrpzydrbhgibydqoraycoktqtqgwioqrzpqhwqirgoendmokcvhncgvjzdyewuvleieohxdmpfvhfwnqmknglkcxlakroowamkqtjqcdzhdciibyfiyenvimerqspwkcibzwfnciauczicthcidoakrnitebqwhdfibfgjujqygjoqvfilzaibaaxqrgqphodvunvprmqjwghkgwxuemlbeacuxinfbcvmqvjthwjboffioailkrkhbjglfakmcpiqughqyacicemsbmajjuhcsqyevwztmykxpejxtuebwqunxwzqeqyqszavszwvwuhcabeuldmorbuaurvhpiaozcxqrcvqcxxpizcihxyghxuopmcpvjybtuugctekiuxwjtseapbpivdwgvpjwqjoooydrgjcpajocqoimggcscexqiletuqidwlhppmafapvomjxenlmkdkakykmdgwaxjilcmmsclnyibidbvjuehinqkgylznazyumrrgxcbxnotyeujpbrefpnkjjixxuimuhjprvmdfufcgqzprhokyonerghcfkrckhlizsgaxnmnxqgmikybp 20000
+it kemubcrdlsbqgbcnnchcrnbsdhuusbssmbhbrejnerdsjrvfdssugldrwcsbtgpvrnykosoljhzfwyhcsjqpkxojtcdqnfykepnbvcyrszkkwltpszoccipwvcbxwjusvojwmvlaolftdpbgyjexhmmpcfomrienriwnlvmhecfehvhapsfijaenrltskewqtuvxboyvzrmmmmdpumbgcgofdktbdaserdltacgtmeuiltlpddpoppjcedxkxipwfqagqlewrayqjucwiqlflyhrryqkuhtzzygzhmxzhgqplxaazipigwtlozxllchdhpgkgpttapulzucvdmzwygpfnzukczxmomxcxffeaesozuettpvlerreaazxudqxenggaigjqhyskirnebxlovsqnqereqqaoyftayzefeptxdrbkvqqrpzydrbhgibydqoraycoktqtqgwioqrzpqhwqirgoendmokcvhncgvjzdyewuvleieohxdmpfvhfwnqmknglkcxlakroowamkqtjqcdzhdciibyfiyenvimerqspwkcibzwfnciauczicthcidoakrnitebqwhdfibfgjujqygjoqvfilzaibaaxqrgqphodvunvprmqjwghkgwxuemlbeacuxinfbcvmqvjthwjboffioailkrkhbjglfakmcpiqughqyacicemsbmajjuhcsqyevwztmykxpejxtuebwqunxwzqeqyqszavszwvwuhcabeuldmorbuaurvhpiaozcxqrcvqcxxpizcihxyghxuopmcpvjybtuugctekiuxwjtseapbpivdwgvpjwqjoooydrgjcpajocqoimggcscexqiletuqidwlhppmafapvomjxenlmkdkakykmdgwaxjilcmmsclnyibidbvjuehinqkgylznazyumrrgxcbxnotyeujpbrefpnkjjixxuimuhjprvmdfufcgqzprhokyonerghcfkrckhlizsgaxnmnxqgmikybz 20000
+reverse
+sort
+free
@@ -0,0 +1,26 @@
+# Test of ownership-transferring insert and zero-copy remove
+option fail 0
+option malloc 0
+new
+iho gerbil
+ito bear
+iho dolphin
+it meerkat
+rhv dolphin
+rtv meerkat
+rh gerbil
+rtv bear
+free
+option arena 1
+new
+ito vulture 3
+ih gerbil
+rhv gerbil
+rtv vulture
+free
+option arena 0
+new
+ito dolphin 100000
+iho bear 100000
+size
+free
@@ -0,0 +1,37 @@
+# Test of recycling released elements
+option fail 0
+option malloc 0
+option recycle 4
+new
+ih gerbil 3
+it bear
+rh gerbil
+rt bear
+rh gerbil
+ih dolphin
+it meerkat
+recycle
+rhv dolphin
+rtv meerkat
+dm
+clone
+restore
+option recycle 2
+new
+it vulturevulturevulturevulture 3
+rh vulturevulturevulturevulture
+rh vulturevulturevulturevulture
+ih gerbil
+rhv gerbil
+rh vulturevulturevulturevulture
+option recycle 0
+ih bear
+rh bear
+free
+option recycle 64
+new
+it dolphin 2000
+dedup
+it dolphin 2000
+recycle
+free
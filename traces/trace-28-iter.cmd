@@ -0,0 +1,29 @@
+# Test of iterators, batched walks and seeking
+option fail 0
+option malloc 0
+new
+iter
+seek 0
+it gerbil
+it bear
+it dolphin
+it meerkat
+it vulture
+iter
+iter 2
+iter 8
+seek 0 4 2 1 3 5 0
+reverse
+iter 3
+seek 4 0 3 1 2
+pqpush aardvark
+iter 4
+seek 0 5
+free
+new
+it dolphin 100000
+ih gerbil
+reverse
+iter 64
+seek 0 50000 99999 100000 1 99998
+free
@@ -0,0 +1,14 @@
+# Test of freeing a million elements with cautious mode on
+option fail 0
+option malloc 0
+new
+it dolphin 1000000
+dedup
+size
+free
+new
+ih gerbil 500000
+it bear 500000
+clone
+restore
+free
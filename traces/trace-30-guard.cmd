@@ -0,0 +1,26 @@
+# Test of queue operations with guard pages behind every block
+option fail 0
+option malloc 0
+option guard 1
+new
+ih dolphin
+ih bear
+it gerbil
+it meerkat
+reverse
+sort
+rh bear
+rt meerkat
+ih a 100
+dedup
+size
+free
+option guard 0
+# Test of large strings that are not filled when allocated and freed
+option nofill 64
+new
+ih RAND 1000
+it aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa
+rt aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa
+sort
+free
@@ -0,0 +1,10 @@
+# Test of threads allocating elements and freeing each other's queues
+option fail 0
+option malloc 0
+threads 4 100000
+threads 16 1000
+option malloc 10
+threads 8 10000
+option malloc 0
+option deferfree 1
+threads 4 10000
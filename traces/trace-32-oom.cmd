@@ -0,0 +1,35 @@
+# Test of failing each allocation of queue operations in turn
+option fail 0
+option malloc 0
+oom new
+oom ih dolphin
+oom ih bear 3
+oom it gerbil 3
+oom iho meerkat
+oom ito cat
+oom clone
+oom pqpush zebra
+oom pqmeld
+oom new
+option arena 1
+oom new
+oom ih dolphin 5
+oom it bear 40
+option arena 0
+option recycle 4
+oom new
+oom ih dolphin 5
+rh dolphin
+oom it gerbil 5
+option recycle 0
+free
+# Fail every allocation of one call site
+option fail 10
+new
+failsite create_element
+ih dolphin
+it bear
+size
+failsite
+it bear
+free
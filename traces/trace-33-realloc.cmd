@@ -0,0 +1,12 @@
+# Test of growing and shrinking blocks with realloc
+option fail 0
+option malloc 0
+grow 1
+grow 5000
+option guard 1
+grow 200
+option guard 0
+oom grow 40
+option fail 10
+option malloc 20
+grow 1000
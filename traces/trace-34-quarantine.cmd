@@ -0,0 +1,37 @@
+# Test of queue operations with freed blocks held in quarantine
+option fail 0
+option malloc 0
+option quarantine 65536
+new
+ih dolphin 200
+it bear 200
+ih gerbil 200
+sort
+dedup
+size
+ih meerkat
+ih cat
+dm
+swap
+reverse
+clone
+rh
+rt
+restore
+size
+free
+option recycle 8
+new
+it dolphin 1000
+rh dolphin
+rh dolphin
+rt dolphin
+dm
+it bear 1000
+free
+option recycle 0
+# Quarantine smaller than the blocks freed
+option quarantine 1000
+new
+ih dolphin 100000
+free
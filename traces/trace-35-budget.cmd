@@ -0,0 +1,23 @@
+# Test of per-command time budgets, scaled to the speed of this machine
+option fail 0
+option malloc 0
+calibrate
+option timelimit 500
+budget sort 4000
+budget reverse 2000
+budget
+new
+ih RAND 100000
+sort
+reverse
+it dolphin 1000
+dedup
+free
+# No time limit at all
+budget sort 0
+option timelimit 0
+new
+ih RAND 100000
+sort
+free
+option timelimit 1000
@@ -0,0 +1,28 @@
+# Test of memory statistics across queue layouts
+option fail 0
+option malloc 0
+mem
+new
+ih RAND 1000
+mem
+clone
+it dolphin 100
+mem
+free
+mem
+option arena 1
+new
+ih RAND 1000
+mem
+free
+option arena 0
+option guard 1
+option quarantine 4096
+new
+ih gerbil 10
+rh gerbil
+mem
+free
+option guard 0
+option quarantine 0
+mem
@@ -0,0 +1,23 @@
+# Test of queue operations with allocation backtraces recorded
+option fail 0
+option malloc 0
+option backtrace 16
+new
+ih dolphin 1000
+it gerbil 1000
+sort
+dedup
+reverse
+clone
+rh
+restore
+free
+option arena 1
+new
+ih RAND 1000
+free
+option arena 0
+option deferfree 1
+threads 4 1000
+option deferfree 0
+option backtrace 0
@@ -0,0 +1,30 @@
+# Test of histograms of block sizes and lifetimes
+option fail 0
+option malloc 0
+hist
+option histogram 1
+new
+ih RAND 1000
+it dolphin 100
+rh
+rt
+sort
+clone
+dedup
+restore
+free
+option recycle 8
+new
+it gerbil 1000
+rh gerbil
+dm
+free
+option recycle 0
+grow 1000
+threads 4 1000
+hist
+option histogram 0
+new
+ih meerkat 100
+free
+hist
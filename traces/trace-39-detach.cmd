@@ -0,0 +1,30 @@
+# Test of working on a clone while the original is freed in the background
+option fail 0
+option malloc 0
+option deferfree 1
+new
+ih RAND 100000
+it dolphin 1000
+clone
+restore
+rh
+rt dolphin
+it gerbil 1000
+reverse
+rh gerbil
+sort
+dedup
+size
+clone
+dm
+restore
+rh
+sort
+dedup
+free
+# Clones failing partway in deferred mode
+new
+ih RAND 100
+oom clone
+free
+option deferfree 0
@@ -0,0 +1,43 @@
+# Test of taking strings from a queue while a clone shares them
+option fail 0
+option malloc 0
+new
+ih dolphin
+ih bear
+ih gerbil
+clone
+rhv gerbil
+rtv dolphin
+restore
+rh gerbil
+rh bear
+rh dolphin
+free
+new
+ito meerkat
+ito cat
+it bear
+clone
+rhv meerkat
+ito meerkat
+rtv meerkat
+restore
+rh meerkat
+rh cat
+rh bear
+free
+# Strings shared with a queue freed in the background
+option deferfree 1
+new
+ih RAND 10000
+ih dolphin
+ih gerbil
+clone
+restore
+rhv gerbil
+clone
+rhv dolphin
+restore
+rh dolphin
+free
+option deferfree 0
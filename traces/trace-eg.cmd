@@ -1,5 +1,7 @@
 # Demonstration of queue testing framework
 # Use help command to see list of commands and options
+# Time blocks, so that allocs shows how long they lived
+option profile 1
 # Initial queue is NULL.
 show
 # Create empty queue
@@ -19,5 +21,7 @@ reverse
 size
 # Delete queue.  Goes back to a NULL queue.
 free
+# See which lines of queue.c allocated memory, and how much
+allocs
 # Exit program
 quit
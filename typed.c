@@ -0,0 +1,52 @@
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "harness.h"
+#include "typed.h"
+
+static inline int int_cmp(const int *a, const int *b)
+{
+    return (*a > *b) - (*a < *b);
+}
+
+/* Records compare by key only, which shows whether sorting is stable */
+#define record_cmp(a, b) int_cmp(&(a)->key, &(b)->key)
+
+QUEUE_IMPLEMENT(iq, int, int_cmp)
+QUEUE_IMPLEMENT(rq, record_t, record_cmp)
+
+static inline int long_cmp(const long *a, const long *b)
+{
+    return (*a > *b) - (*a < *b);
+}
+
+/* Private to this file, which keeps QUEUE_DEFINE built and run */
+QUEUE_DEFINE(lq, long, long_cmp)
+
+int typed_distinct(struct list_head *ints)
+{
+    struct list_head *longs = lq_new();
+    if (!longs)
+        return -1;
+    iq_element_t *item = NULL;
+    list_for_each_entry (item, ints, list) {
+        if (!lq_insert_tail(longs, item->value)) {
+            lq_free(longs);
+            return -1;
+        }
+    }
+
+    lq_sort(longs);
+    lq_delete_dup(longs);
+    int left = lq_size(longs);
+    lq_element_t *elem = NULL, *prev = NULL;
+    list_for_each_entry (elem, longs, list) {
+        if (prev && prev->value >= elem->value) {
+            left = -2;
+            break;
+        }
+        prev = elem;
+    }
+    lq_free(longs);
+    return left;
+}
@@ -0,0 +1,28 @@
+#ifndef LAB0_TYPED_H
+#define LAB0_TYPED_H
+
+/*
+ * Typed queues exercised by the typed command of qtest.  They are implemented
+ * in typed.c, which allocates through the harness like queue.c does.  A
+ * third queue there is defined with QUEUE_DEFINE, and used through
+ * typed_distinct() alone.
+ */
+
+#include "typed_queue.h"
+
+typedef struct {
+    int key;
+    int seq;
+} record_t;
+
+QUEUE_DECLARE(iq, int)
+QUEUE_DECLARE(rq, record_t)
+
+/*
+ * Copy the integers of queue ints into a queue defined with QUEUE_DEFINE,
+ * sort and dedup it, and return how many integers are left.  Return -1 if
+ * the copy could not be made, or -2 if it was not left strictly ascending.
+ */
+int typed_distinct(struct list_head *ints);
+
+#endif /* LAB0_TYPED_H */
@@ -0,0 +1,232 @@
+#ifndef LAB0_TYPED_QUEUE_H
+#define LAB0_TYPED_QUEUE_H
+
+/*
+ * Typed queues.
+ *
+ * QUEUE_DEFINE(name, type, cmp) generates a queue whose elements hold a value
+ * of the given type inline, instead of a pointer to a string.  cmp is a
+ * function or macro taking two const type * and returning a negative, zero or
+ * positive value like strcmp; it is called directly, so the compiler can
+ * inline it.  The generated functions mirror those of queue.h, with a queue
+ * being handed around as the struct list_head in its name_queue_t:
+ *
+ *   name_element_t                  element with value and list members
+ *   struct list_head *name_new()
+ *   void name_free(struct list_head *head)
+ *   bool name_insert_head(struct list_head *head, type value)
+ *   bool name_insert_tail(struct list_head *head, type value)
+ *   bool name_remove_head(struct list_head *head, type *value)
+ *   bool name_remove_tail(struct list_head *head, type *value)
+ *   int name_size(struct list_head *head)
+ *   void name_reverse(struct list_head *head)
+ *   void name_sort(struct list_head *head)
+ *   bool name_delete_dup(struct list_head *head)
+ *
+ * name_sort is a stable merge sort, and name_delete_dup keeps only the first
+ * of each run of equal values in a sorted queue, like q_delete_dup.
+ * Removing an element copies its value to *value unless value is NULL, and
+ * frees the element.  The queue counts its elements, so name_size takes O(1)
+ * time; lists of elements must therefore only be changed through these
+ * functions.
+ *
+ * Every function of QUEUE_DEFINE is static inline, so any translation unit
+ * may define the queues it needs.  Alternatively, QUEUE_DECLARE(name, type)
+ * in a header declares the queue, and QUEUE_IMPLEMENT(name, type, cmp) in one
+ * translation unit defines its functions.  The functions allocate with the
+ * malloc and free in scope where they are defined, so a queue implemented
+ * next to harness.h has its elements checked like those of queue.c.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "list.h"
+
+#define QUEUE_TYPES(name, type)                                               \
+    typedef struct {                                                          \
+        type value;                                                           \
+        struct list_head list;                                                \
+    } name##_element_t;                                                       \
+                                                                              \
+    typedef struct {                                                          \
+        struct list_head head;                                                \
+        int size;                                                             \
+    } name##_queue_t;
+
+#define QUEUE_DECLARE(name, type)                                             \
+    QUEUE_TYPES(name, type)                                                   \
+    struct list_head *name##_new();                                           \
+    void name##_free(struct list_head *head);                                 \
+    bool name##_insert_head(struct list_head *head, type value);              \
+    bool name##_insert_tail(struct list_head *head, type value);              \
+    bool name##_remove_head(struct list_head *head, type *value);             \
+    bool name##_remove_tail(struct list_head *head, type *value);             \
+    int name##_size(struct list_head *head);                                  \
+    void name##_reverse(struct list_head *head);                              \
+    void name##_sort(struct list_head *head);                                 \
+    bool name##_delete_dup(struct list_head *head);
+
+#define QUEUE_FUNCTIONS(name, type, cmp, linkage)                             \
+    static inline name##_element_t *name##_entry(struct list_head *node)      \
+    {                                                                         \
+        return list_entry(node, name##_element_t, list);                      \
+    }                                                                         \
+                                                                              \
+    static inline name##_queue_t *name##_queue(struct list_head *head)        \
+    {                                                                         \
+        return container_of(head, name##_queue_t, head);                      \
+    }                                                                         \
+                                                                              \
+    static inline int name##_cmp(struct list_head *a, struct list_head *b)    \
+    {                                                                         \
+        return cmp(&name##_entry(a)->value, &name##_entry(b)->value);         \
+    }                                                                         \
+                                                                              \
+    linkage struct list_head *name##_new()                                    \
+    {                                                                         \
+        name##_queue_t *q = malloc(sizeof(name##_queue_t));                   \
+        if (!q)                                                               \
+            return NULL;                                                      \
+        INIT_LIST_HEAD(&q->head);                                             \
+        q->size = 0;                                                          \
+        return &q->head;                                                      \
+    }                                                                         \
+                                                                              \
+    linkage void name##_free(struct list_head *head)                          \
+    {                                                                         \
+        if (!head)                                                            \
+            return;                                                           \
+        name##_element_t *entry, *safe;                                       \
+        list_for_each_entry_safe (entry, safe, head, list)                    \
+            free(entry);                                                      \
+        free(name##_queue(head));                                             \
+    }                                                                         \
+                                                                              \
+    linkage bool name##_insert_head(struct list_head *head, type value)       \
+    {                                                                         \
+        if (!head)                                                            \
+            return false;                                                     \
+        name##_element_t *elem = malloc(sizeof(name##_element_t));            \
+        if (!elem)                                                            \
+            return false;                                                     \
+        elem->value = value;                                                  \
+        list_add(&elem->list, head);                                          \
+        name##_queue(head)->size++;                                           \
+        return true;                                                          \
+    }                                                                         \
+                                                                              \
+    linkage bool name##_insert_tail(struct list_head *head, type value)       \
+    {                                                                         \
+        if (!head)                                                            \
+            return false;                                                     \
+        name##_element_t *elem = malloc(sizeof(name##_element_t));            \
+        if (!elem)                                                            \
+            return false;                                                     \
+        elem->value = value;                                                  \
+        list_add_tail(&elem->list, head);                                     \
+        name##_queue(head)->size++;                                           \
+        return true;                                                          \
+    }                                                                         \
+                                                                              \
+    static inline bool name##_remove(struct list_head *head,                  \
+                                     struct list_head *node, type *value)     \
+    {                                                                         \
+        name##_element_t *elem = name##_entry(node);                          \
+        if (value)                                                            \
+            *value = elem->value;                                             \
+        list_del(node);                                                       \
+        free(elem);                                                           \
+        name##_queue(head)->size--;                                           \
+        return true;                                                          \
+    }                                                                         \
+                                                                              \
+    linkage bool name##_remove_head(struct list_head *head, type *value)      \
+    {                                                                         \
+        if (!head || list_empty(head))                                        \
+            return false;                                                     \
+        return name##_remove(head, head->next, value);                        \
+    }                                                                         \
+                                                                              \
+    linkage bool name##_remove_tail(struct list_head *head, type *value)      \
+    {                                                                         \
+        if (!head || list_empty(head))                                        \
+            return false;                                                     \
+        return name##_remove(head, head->prev, value);                        \
+    }                                                                         \
+                                                                              \
+    linkage int name##_size(struct list_head *head)                           \
+    {                                                                         \
+        return head ? name##_queue(head)->size : 0;                           \
+    }                                                                         \
+                                                                              \
+    linkage void name##_reverse(struct list_head *head)                       \
+    {                                                                         \
+        if (!head)                                                            \
+            return;                                                           \
+        struct list_head *node, *safe;                                        \
+        list_for_each_safe (node, safe, head)                                 \
+            list_move(node, head);                                            \
+    }                                                                         \
+                                                                              \
+    /* Merge sorted list b into sorted list a; ties keep a first */           \
+    static inline void name##_merge(struct list_head *a, struct list_head *b) \
+    {                                                                         \
+        LIST_HEAD(merged);                                                    \
+        while (!list_empty(a) && !list_empty(b)) {                            \
+            if (name##_cmp(b->next, a->next) < 0)                             \
+                list_move_tail(b->next, &merged);                             \
+            else                                                              \
+                list_move_tail(a->next, &merged);                             \
+        }                                                                     \
+        list_splice_tail_init(a, &merged);                                    \
+        list_splice_tail_init(b, &merged);                                    \
+        list_splice(&merged, a);                                              \
+    }                                                                         \
+                                                                              \
+    /* Sort a plain list, which the halves being sorted are */                \
+    static inline void name##_sort_list(struct list_head *head)               \
+    {                                                                         \
+        if (list_empty(head) || list_is_singular(head))                       \
+            return;                                                           \
+        struct list_head *slow = head->next, *fast = head->next->next;        \
+        while (fast != head && fast->next != head) {                          \
+            slow = slow->next;                                                \
+            fast = fast->next->next;                                          \
+        }                                                                     \
+        LIST_HEAD(front);                                                     \
+        list_cut_position(&front, head, slow);                                \
+        name##_sort_list(&front);                                             \
+        name##_sort_list(head);                                               \
+        name##_merge(&front, head);                                           \
+        list_splice(&front, head);                                            \
+    }                                                                         \
+                                                                              \
+    linkage void name##_sort(struct list_head *head)                          \
+    {                                                                         \
+        if (head)                                                             \
+            name##_sort_list(head);                                           \
+    }                                                                         \
+                                                                              \
+    linkage bool name##_delete_dup(struct list_head *head)                    \
+    {                                                                         \
+        if (!head)                                                            \
+            return false;                                                     \
+        struct list_head *node = head->next;                                  \
+        while (node != head && node->next != head) {                          \
+            if (name##_cmp(node, node->next))                                 \
+                node = node->next;                                            \
+            else                                                              \
+                name##_remove(head, node->next, NULL);                        \
+        }                                                                     \
+        return true;                                                          \
+    }
+
+#define QUEUE_DEFINE(name, type, cmp) \
+    QUEUE_TYPES(name, type)           \
+    QUEUE_FUNCTIONS(name, type, cmp, static inline)
+
+#define QUEUE_IMPLEMENT(name, type, cmp) \
+    QUEUE_FUNCTIONS(name, type, cmp, extern)
+
+#endif /* LAB0_TYPED_QUEUE_H */